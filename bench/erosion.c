@@ -0,0 +1,163 @@
+/*
+ * Microbenchmark for the erosion engines.
+ *
+ *   gcc -O2 -I. bench/erosion.c config.c erosion.c heightmap.c parallel.c \
+ *       -lm -lpthread -o erosion-bench
+ *   ./erosion-bench [--world WxH] [--threads N]
+ *
+ * Erodes the same synthetic terrain with the one-at-a-time and the lockstep
+ * droplet engines, each with plain random and Morton-sorted spawn order, and
+ * reports droplets/second, last-level cache misses and wall time on stderr.
+ * Cache misses come from perf_event_open and show as n/a where perf events
+ * are unavailable. Then runs the tiled erode_parallel engine, the generator's
+ * default, on 1, 2, 4, ... threads up to --threads (one per online core by
+ * default) and reports droplets/second and the speedup over one thread.
+ * Last it runs the pipe-model grid engine and reports cells/second and its
+ * wall time.
+ */
+#include "config.h"
+#include "erosion.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define N_DROPLETS 400000
+#define N_GRID_STEPS 100
+#define SEALEVEL 0.4f
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Opens a counter for hardware cache misses of this thread, or returns -1.
+static int openCacheMisses() {
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+typedef void (*Engine)(Erosion *erosion, Heightmap *map, int numIterations,
+                       float sealevel);
+
+static void runEngine(const char *name, Engine engine, Erosion *erosion,
+                      Heightmap *map, const Heightmap *terrain) {
+  heightmapCopy(map, terrain);
+  srand(12);
+  int counter = openCacheMisses();
+#ifdef __linux__
+  if (counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+  double start = now();
+  engine(erosion, map, N_DROPLETS, SEALEVEL);
+  double seconds = now() - start;
+
+  long long misses = -1;
+#ifdef __linux__
+  if (counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+      misses = -1;
+    close(counter);
+  }
+#endif
+  if (misses >= 0) {
+    fprintf(stderr,
+            "%-22s %12.0f droplets/s  %8.1f cache misses/droplet  %.2fs\n",
+            name, N_DROPLETS / seconds, (double)misses / N_DROPLETS, seconds);
+  } else {
+    fprintf(stderr, "%-22s %12.0f droplets/s  cache misses n/a  %.2fs\n",
+            name, N_DROPLETS / seconds, seconds);
+  }
+}
+
+// Runs erode_parallel on nThreads threads. The tiles' droplets are fixed by
+// the seed, so every thread count does the same work.
+static double runParallel(Erosion *erosion, Heightmap *map,
+                          const Heightmap *terrain, size_t nThreads,
+                          double serialSeconds) {
+  heightmapCopy(map, terrain);
+  double start = now();
+  erode_parallel(erosion, map, N_DROPLETS, SEALEVEL, nThreads, 12);
+  double seconds = now() - start;
+  char name[48];
+  snprintf(name, sizeof(name), "erode_parallel x%zu", nThreads);
+  fprintf(stderr, "%-22s %12.0f droplets/s  %8.2fx one thread\n", name,
+          N_DROPLETS / seconds,
+          serialSeconds > 0 ? serialSeconds / seconds : 1.0);
+  return seconds;
+}
+
+int main(int argc, char **argv) {
+  Config config;
+  config_init(&config);
+  if (!config_parse(&config, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+  Heightmap terrain, map;
+  if (!heightmap_init(&terrain, config.worldWidth, config.worldHeight) ||
+      !heightmap_init(&map, config.worldWidth, config.worldHeight)) {
+    return EXIT_FAILURE;
+  }
+  for (int y = 0; y < terrain.height; ++y) {
+    float *row = heightmapRow(&terrain, y);
+    for (int x = 0; x < terrain.width; ++x) {
+      row[x] =
+          0.5f + 0.25f * sinf(x * 0.011f) * cosf(y * 0.017f) +
+          0.1f * sinf((x + y) * 0.05f);
+    }
+  }
+
+  Erosion erosion;
+  erode_init(&erosion, &config);
+
+  erosion.sortSpawns = false;
+  runEngine("erode (random)", erode, &erosion, &map, &terrain);
+  runEngine("erode_batch (random)", erode_batch, &erosion, &map, &terrain);
+  erosion.sortSpawns = true;
+  runEngine("erode (morton)", erode, &erosion, &map, &terrain);
+  runEngine("erode_batch (morton)", erode_batch, &erosion, &map, &terrain);
+
+  const size_t maxThreads = threadCount(config.nThreads);
+  double oneThread = runParallel(&erosion, &map, &terrain, 1, 0);
+  for (size_t nThreads = 2; nThreads < 2 * maxThreads; nThreads *= 2) {
+    if (nThreads > maxThreads)
+      nThreads = maxThreads;
+    runParallel(&erosion, &map, &terrain, nThreads, oneThread);
+  }
+
+  heightmapCopy(&map, &terrain);
+  double start = now();
+  double cellsPerSecond = erode_grid(&map, N_GRID_STEPS, SEALEVEL, 0);
+  double gridTime = now() - start;
+  fprintf(stderr, "%-22s %12.0f cells/s     (%d steps in %.2fs)\n",
+          "erode_grid", cellsPerSecond, N_GRID_STEPS, gridTime);
+
+  free_erode(&erosion);
+  free_heightmap(&terrain);
+  free_heightmap(&map);
+  return EXIT_SUCCESS;
+}
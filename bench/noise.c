@@ -0,0 +1,86 @@
+/*
+ * Microbenchmark for the batched noise API.
+ *
+ *   gcc -O2 -I. bench/noise.c open-simplex-noise.c -lm -o noise-bench
+ *
+ * Evaluates the same random points through the scalar and batched functions
+ * and reports points/second for both plus the largest absolute difference.
+ */
+#include "open-simplex-noise.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define N_POINTS (1 << 20)
+#define REPEATS 5
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float randomCoordinate(float range) {
+  return ((float)rand() / RAND_MAX * 2 - 1) * range;
+}
+
+int main() {
+  struct osn_context *ctx;
+  open_simplex_noise(12, &ctx);
+
+  float *xs = (float *)malloc(N_POINTS * sizeof(float));
+  float *ys = (float *)malloc(N_POINTS * sizeof(float));
+  float *zs = (float *)malloc(N_POINTS * sizeof(float));
+  float *scalar = (float *)malloc(N_POINTS * sizeof(float));
+  float *batch = (float *)malloc(N_POINTS * sizeof(float));
+  if (!xs || !ys || !zs || !scalar || !batch) {
+    fprintf(stderr, "Memory allocation failed for benchmark buffers.\n");
+    return EXIT_FAILURE;
+  }
+  srand(12);
+  for (size_t i = 0; i < N_POINTS; ++i) {
+    xs[i] = randomCoordinate(1000);
+    ys[i] = randomCoordinate(1000);
+    zs[i] = randomCoordinate(50);
+  }
+
+  for (int dims = 2; dims <= 3; ++dims) {
+    double start = now();
+    for (int r = 0; r < REPEATS; ++r) {
+      for (size_t i = 0; i < N_POINTS; ++i) {
+        scalar[i] = dims == 2
+                        ? open_simplex_noise2(ctx, xs[i], ys[i])
+                        : open_simplex_noise3(ctx, xs[i], ys[i], zs[i]);
+      }
+    }
+    double scalarTime = now() - start;
+
+    start = now();
+    for (int r = 0; r < REPEATS; ++r) {
+      if (dims == 2)
+        open_simplex_noise2_batch(ctx, xs, ys, batch, N_POINTS);
+      else
+        open_simplex_noise3_batch(ctx, xs, ys, zs, batch, N_POINTS);
+    }
+    double batchTime = now() - start;
+
+    float maxError = 0;
+    for (size_t i = 0; i < N_POINTS; ++i) {
+      maxError = fmaxf(maxError, fabsf(scalar[i] - batch[i]));
+    }
+    double total = (double)N_POINTS * REPEATS;
+    printf("%dD scalar: %.1f Mpts/s  batch: %.1f Mpts/s  speedup: %.2fx  "
+           "max error: %g (tolerance %g)\n",
+           dims, total / scalarTime / 1e6, total / batchTime / 1e6,
+           scalarTime / batchTime, maxError, OSN_BATCH_TOLERANCE);
+  }
+
+  free(xs);
+  free(ys);
+  free(zs);
+  free(scalar);
+  free(batch);
+  open_simplex_noise_free(ctx);
+  return 0;
+}
@@ -1,6 +1,15 @@
 #include "colors.h"
 #include "common.h"
+#include "parallel.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define COLORS_SIMD 1
+#include <immintrin.h>
+#endif
 
 Color colors[31];
 
@@ -55,7 +64,6 @@ void initializeHeight(float **heights) {
 }
 
 static size_t getIndex(float *heights, float value) {
-  size_t length = (sizeof(&heights) / sizeof(float));
   for (size_t i = 0; i < 31; ++i) {
     if (value >= heights[i] && (i == 30 || value < heights[i + 1])) {
       return i;
@@ -77,3 +85,119 @@ Color getColor(float *heights, float value, float sealevel) {
   Color c = colors[getIndex(heights, value)];
   return c;
 }
+
+// Packs a colour as RGBA8 bytes in memory order, whatever the endianness.
+static uint32_t packColor(Color rgb) {
+  uint8_t bytes[4] = {(uint8_t)(rgb.r * 255 + 0.5f),
+                      (uint8_t)(rgb.g * 255 + 0.5f),
+                      (uint8_t)(rgb.b * 255 + 0.5f), 255};
+  uint32_t packed;
+  memcpy(&packed, bytes, sizeof(packed));
+  return packed;
+}
+
+// Entry i holds the colour at the centre of [i, i + 1) / COLOR_LUT_SIZE, so a
+// height is never more than half a step from the one it is coloured as.
+static void buildLut(Colorizer *colorizer, float sealevel) {
+  float *heights;
+  initializeHeight(&heights);
+  for (int i = 0; i < COLOR_LUT_SIZE; ++i) {
+    float value = (i + 0.5f) / COLOR_LUT_SIZE;
+    colorizer->lut[i] = packColor(getColor(heights, value, sealevel));
+  }
+  free(heights);
+  colorizer->sealevel = sealevel;
+}
+
+bool colorizer_init(Colorizer *colorizer, int width, int height) {
+  colorizer->width = width;
+  colorizer->height = height;
+  colorizer->pixels = (uint32_t *)malloc((size_t)width * height * 4);
+  if (colorizer->pixels == NULL) {
+    fprintf(stderr, "Memory allocation failed for %dx%d image.\n", width,
+            height);
+    return false;
+  }
+  addColors();
+  buildLut(colorizer, 0.5f);
+  return true;
+}
+
+void free_colorizer(Colorizer *colorizer) {
+  free(colorizer->pixels);
+  colorizer->pixels = NULL;
+}
+
+typedef struct {
+  const Colorizer *colorizer;
+  const Heightmap *map;
+  size_t nBands;
+} ColorizeJob;
+
+// Heights outside [0, 1], and NaN, take the nearest end of the table.
+static int lutIndex(float value) {
+  float scaled = value * COLOR_LUT_SIZE;
+  if (!(scaled > 0))
+    return 0;
+  return scaled < COLOR_LUT_SIZE - 1 ? (int)scaled : COLOR_LUT_SIZE - 1;
+}
+
+static void colorizeRow(const uint32_t *lut, const float *row, uint32_t *out,
+                        int x0, int x1) {
+  for (int x = x0; x < x1; ++x) {
+    out[x] = lut[lutIndex(row[x])];
+  }
+}
+
+#ifdef COLORS_SIMD
+// Eight cells at a time with a gather from the table. Returns the first
+// column left over.
+__attribute__((target("avx2"))) static int
+colorizeRowAVX2(const uint32_t *lut, const float *row, uint32_t *out,
+                int width) {
+  const __m256 scale = _mm256_set1_ps(COLOR_LUT_SIZE);
+  const __m256 last = _mm256_set1_ps(COLOR_LUT_SIZE - 1);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256 scaled = _mm256_mul_ps(_mm256_loadu_ps(row + x), scale);
+    // max_ps returns its second operand for NaN, as lutIndex() does.
+    scaled = _mm256_min_ps(_mm256_max_ps(scaled, _mm256_setzero_ps()), last);
+    __m256i index = _mm256_cvttps_epi32(scaled);
+    _mm256_storeu_si256((__m256i *)(out + x),
+                        _mm256_i32gather_epi32((const int *)lut, index, 4));
+  }
+  return x;
+}
+
+#endif
+
+static void colorizeTask(void *arg, size_t begin, size_t end) {
+  const ColorizeJob *job = (const ColorizeJob *)arg;
+  const Colorizer *colorizer = job->colorizer;
+  const int width = job->map->width;
+  for (size_t band = begin; band < end; ++band) {
+    int y0 = job->map->height * band / job->nBands;
+    int y1 = job->map->height * (band + 1) / job->nBands;
+    for (int y = y0; y < y1; ++y) {
+      const float *row = heightmapRow(job->map, y);
+      uint32_t *out = colorizer->pixels + (size_t)y * width;
+      int x = 0;
+#ifdef COLORS_SIMD
+      if (haveAVX2())
+        x = colorizeRowAVX2(colorizer->lut, row, out, width);
+#endif
+      colorizeRow(colorizer->lut, row, out, x, width);
+    }
+  }
+}
+
+void colorize(Colorizer *colorizer, const Heightmap *map, float sealevel,
+              size_t nThreads) {
+  if (sealevel != colorizer->sealevel)
+    buildLut(colorizer, sealevel);
+  size_t nBands = threadCount(nThreads);
+  if (nBands > (size_t)map->height)
+    nBands = map->height;
+  ColorizeJob job = {colorizer, map, nBands};
+  parallelFor(nBands, nBands, colorizeTask, &job);
+}
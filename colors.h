@@ -1,5 +1,7 @@
 #pragma once
 #include "common.h"
+#include "heightmap.h"
+#include <stdint.h>
 
 typedef struct {
   float r, g, b;
@@ -9,3 +11,21 @@ void addColors();
 Color color(int r, int g, int b);
 void initializeHeight(float **heights);
 Color getColor(float *heights, float value, float sealevel);
+
+// Colours a normalized map into an RGBA8 image, for the window and for
+// export alike. getColor is sampled into a COLOR_LUT_SIZE table over [0, 1]
+// that is only rebuilt when the sealevel changes, so each cell costs one
+// table lookup.
+#define COLOR_LUT_SIZE 4096
+
+typedef struct {
+  int width, height;
+  uint32_t *pixels; // RGBA8 bytes in memory order, rows like the map's
+  float sealevel;   // the table was built for
+  uint32_t lut[COLOR_LUT_SIZE];
+} Colorizer;
+
+bool colorizer_init(Colorizer *colorizer, int width, int height);
+void free_colorizer(Colorizer *colorizer);
+void colorize(Colorizer *colorizer, const Heightmap *map, float sealevel,
+              size_t nThreads);
@@ -32,8 +32,26 @@
 #define MAX_DROPLET_LIFETIME 30
 #define INITIAL_WATER_VOLUME 1.0f
 #define INITAL_SPEED 1.0f
-#define WINDOW_WIDTH 1800
+#define PIPE_TIME_STEP 0.05f
+#define PIPE_GRAVITY 9.81f
+#define PIPE_RAIN 0.001f
+#define PIPE_EVAPORATE 0.01f
+#define PIPE_CAPACITY 0.02f
+#define PIPE_DISSOLVE 0.05f
+#define PIPE_DEPOSIT 0.05f
+#define PIPE_MIN_TILT 0.01f
+#define GRID_EROSION_STEPS 100
+#define THERMAL_TALUS 0.004f // steepest stable height step between cells
+#define THERMAL_RATE 0.05f   // share of the excess moved per pass
+#define THERMAL_ITERATIONS 20
+#define PYRAMID_LEVELS 3        // full resolution plus two halvings
+#define PYRAMID_FINE_SHARE 0.5f // droplets spent at full resolution
+#define PYRAMID_BUDGET 4        // pyramid runs 1/PYRAMID_BUDGET the droplets
+#define WORLD_WIDTH 1800
+#define WORLD_HEIGHT 900
+#define WINDOW_WIDTH 1800 // largest default window; smaller worlds fit inside
 #define WINDOW_HEIGHT 900
+#define DROPLETS_PER_ITERATION 200000 // for a WORLD_WIDTH x WORLD_HEIGHT map
 #define SIZE_MODIFIER 30
 #define N_LAYERS 50
 #define MAX_ITERATIONS 100
@@ -44,6 +62,22 @@
 #define LACUNARITY 1.23f
 #define SCALE 0.043f
 #define WATER_THRESHOLD 0.75f
+#define SEALEVEL_SAMPLES 1048576 // maps 16x larger sample this many cells
+#define N_THREADS 0 // 0 uses one thread per online core
+#define VORONOI_LABEL_MAP true    // label whole layers instead of per pixel
+#define VORONOI_CROSS_CHECK false // compare label maps with brute force
+#define FUSED_CONTINENTS true     // one tiled pass for all active layers
+#define PARALLEL_EROSION true     // checkerboard-tiled droplets on N_THREADS
+#define DROPLET_BATCH true        // simulate droplets 8 at a time with AVX2
+#define SORTED_SPAWNS true        // run serial droplet batches in Morton order
+#define PYRAMID_EROSION false     // coarse-to-fine droplets on a map pyramid
+#define GRID_EROSION false        // pipe-model grid erosion instead of droplets
+#define THERMAL_EROSION true      // talus relaxation before hydraulic erosion
+#define RENDERER "pbo" // viewer drawing path: points, texture or pbo
+#define FRAME_BUDGET 0 // viewer ms of generation per frame, 0 for a thread
+#define UNIT_CELLS 4096    // fewest cells in a budgeted chunk of rows
+#define UNIT_DROPLETS 1024 // fewest droplets in a budgeted erosion chunk
+#define WORKER_SLICE 50    // viewer thread's ms of generation per stop check
 #define _VARIABLES
 #endif // !_VARIABLES
 
@@ -0,0 +1,117 @@
+#include "config.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+void config_init(Config *config) {
+  config->worldWidth = WORLD_WIDTH;
+  config->worldHeight = WORLD_HEIGHT;
+  config->windowWidth = WINDOW_WIDTH;
+  config->windowHeight = WINDOW_HEIGHT;
+  config->seed = SEED;
+  config->nThreads = N_THREADS;
+  config->maxIterations = MAX_ITERATIONS;
+  config->nLayers = N_LAYERS;
+  config->nStartPoints = N_START_POINTS;
+  config->sizeModifier = SIZE_MODIFIER;
+  config->moveSpeed = MOVE_SPEED;
+  config->octaves = OCTAVES;
+  config->persistence = PERSISTENCE;
+  config->lacunarity = LACUNARITY;
+  config->scale = SCALE;
+  config->erosionRadius = EROSION_RADIUS;
+  config->dropletLifetime = MAX_DROPLET_LIFETIME;
+  config->droplets = DROPLETS_PER_ITERATION;
+  config->waterThreshold = WATER_THRESHOLD;
+  config->output = "map";
+  config->renderer = RENDERER;
+  config->frameBudget = FRAME_BUDGET;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--world WxH] [--window WxH] [--seed N] [--threads N]\n"
+          "          [--iterations N] [--droplets N] [--output PREFIX]\n"
+          "          [--renderer points|texture|pbo] [--budget MS]\n",
+          program);
+}
+
+static bool parseSize(const char *text, int *width, int *height) {
+  char end;
+  return sscanf(text, "%dx%d%c", width, height, &end) == 2 && *width > 1 &&
+         *height > 1;
+}
+
+static bool parseInt(const char *text, int *value) {
+  char end;
+  return sscanf(text, "%d%c", value, &end) == 1 && *value >= 0;
+}
+
+static bool parseFloat(const char *text, float *value) {
+  char end;
+  return sscanf(text, "%f%c", value, &end) == 1 && *value >= 0;
+}
+
+// Reads "--name value" pairs. Without --window the window is the largest
+// that keeps the world's aspect ratio inside the default window, and without
+// --droplets the droplet count scales with the world's area, so a bigger
+// world is eroded as deeply as the default one.
+bool config_parse(Config *config, int argc, char **argv) {
+  bool windowSet = false, dropletsSet = false;
+  for (int i = 1; i < argc; ++i) {
+    const char *name = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    int n = 0;
+    bool ok = value != NULL;
+    if (ok && strcmp(name, "--world") == 0) {
+      ok = parseSize(value, &config->worldWidth, &config->worldHeight);
+    } else if (ok && strcmp(name, "--window") == 0) {
+      ok = parseSize(value, &config->windowWidth, &config->windowHeight);
+      windowSet = true;
+    } else if (ok && strcmp(name, "--seed") == 0) {
+      ok = parseInt(value, &config->seed);
+    } else if (ok && strcmp(name, "--threads") == 0) {
+      ok = parseInt(value, &n);
+      config->nThreads = n;
+    } else if (ok && strcmp(name, "--iterations") == 0) {
+      ok = parseInt(value, &config->maxIterations);
+    } else if (ok && strcmp(name, "--droplets") == 0) {
+      ok = parseInt(value, &config->droplets);
+      dropletsSet = true;
+    } else if (ok && strcmp(name, "--output") == 0) {
+      config->output = value;
+    } else if (ok && strcmp(name, "--renderer") == 0) {
+      ok = strcmp(value, "points") == 0 || strcmp(value, "texture") == 0 ||
+           strcmp(value, "pbo") == 0;
+      config->renderer = value;
+    } else if (ok && strcmp(name, "--budget") == 0) {
+      ok = parseFloat(value, &config->frameBudget);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "Invalid option: %s%s%s\n", name, value ? " " : "",
+              value ? value : "");
+      usage(argv[0]);
+      return false;
+    }
+    i++;
+  }
+
+  if (!windowSet) {
+    double fit = MIN((double)WINDOW_WIDTH / config->worldWidth,
+                     (double)WINDOW_HEIGHT / config->worldHeight);
+    config->windowWidth = MAX(1, (int)(config->worldWidth * fit));
+    config->windowHeight = MAX(1, (int)(config->worldHeight * fit));
+  }
+  if (!dropletsSet) {
+    double area = (double)config->worldWidth * config->worldHeight;
+    config->droplets = (int)(DROPLETS_PER_ITERATION * area /
+                             ((double)WORLD_WIDTH * WORLD_HEIGHT));
+  }
+  return true;
+}
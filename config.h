@@ -0,0 +1,33 @@
+#pragma once
+#include "common.h"
+#include <stddef.h>
+
+// Runtime settings for one world. config_init fills in the defaults from
+// common.h and config_parse overrides them from the command line. The world
+// is generated at worldWidth x worldHeight cells whatever the window size;
+// the window shows a scaled view of it.
+typedef struct {
+  int worldWidth, worldHeight;   // map size in cells
+  int windowWidth, windowHeight; // display size in pixels
+  int seed;
+  size_t nThreads; // 0 uses one thread per online core
+  int maxIterations;
+  int nLayers;      // Voronoi continent layers
+  int nStartPoints; // sites in the first layer; each layer adds one
+  float sizeModifier;
+  float moveSpeed;
+  int octaves; // fBm height map
+  float persistence;
+  float lacunarity;
+  float scale;
+  int erosionRadius;
+  int dropletLifetime;
+  int droplets;         // per iteration; the final pass runs ten times as many
+  float waterThreshold; // share of the map below sealevel
+  const char *output;   // path prefix for the headless generator's files
+  const char *renderer; // viewer drawing path: points, texture or pbo
+  float frameBudget;    // viewer ms of generation per frame, 0 for a thread
+} Config;
+
+void config_init(Config *config);
+bool config_parse(Config *config, int argc, char **argv);
@@ -1,10 +1,13 @@
 #include "continent.h"
 #include "common.h"
 #include "open-simplex-noise.h"
+#include "parallel.h"
+#include "voronoi.h"
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static float distance(float x1, float y1, float x2, float y2) {
   float deltaX = x1 - x2;
@@ -29,90 +32,632 @@ static float max(float a, float b) { return a >= b ? a : b; }
 
 static float min(float a, float b) { return a <= b ? a : b; }
 
-void generateVoronoiNoise(float **map, Vector layerPoints[], const float index,
-                          const size_t length, struct osn_context *ctx,
-                          const float bias_scale, const float rate) {
+// Uniform grid over the map where every cell lists, in index order, the only
+// sites that can be nearest to some point inside it. The lists are built by
+// bounding the nearest distance anywhere in the cell from the distance at its
+// centre, so a lookup only measures the few sites near the cell.
+#define SITE_GRID_CELL 32
+
+typedef struct {
+  const Vector *points;
+  int cols, rows;
+  int *cellStart; // cols * rows + 1 offsets into candidates
+  int *candidates;
+} SiteGrid;
+
+static float boxDistance(float x, float y, float x0, float y0, float x1,
+                         float y1) {
+  float dx = max(max(x0 - x, x - x1), 0);
+  float dy = max(max(y0 - y, y - y1), 0);
+  return sqrt(dx * dx + dy * dy);
+}
+
+static bool siteGridInit(SiteGrid *grid, const Vector points[], size_t length,
+                         int width, int height) {
+  grid->points = points;
+  grid->cols = (width + SITE_GRID_CELL - 1) / SITE_GRID_CELL;
+  grid->rows = (height + SITE_GRID_CELL - 1) / SITE_GRID_CELL;
+  size_t cells = grid->cols * grid->rows;
+  size_t capacity = cells * 4;
+  grid->cellStart = (int *)calloc(cells + 1, sizeof(int));
+  grid->candidates = (int *)calloc(capacity, sizeof(int));
+  if (grid->cellStart == NULL || grid->candidates == NULL) {
+    perror("Failed to allocate memory for site grid");
+    free(grid->cellStart);
+    free(grid->candidates);
+    return false;
+  }
+
+  const float halfDiagonal = SITE_GRID_CELL * (float)M_SQRT1_2;
+  size_t used = 0;
+  for (int gy = 0; gy < grid->rows; ++gy) {
+    for (int gx = 0; gx < grid->cols; ++gx) {
+      float x0 = gx * SITE_GRID_CELL, y0 = gy * SITE_GRID_CELL;
+      float x1 = x0 + SITE_GRID_CELL, y1 = y0 + SITE_GRID_CELL;
+      float centreD = FLT_MAX;
+      for (size_t i = 0; i < length; ++i) {
+        centreD = min(centreD, distance(x0 + SITE_GRID_CELL / 2.0f,
+                                        y0 + SITE_GRID_CELL / 2.0f,
+                                        points[i].x, points[i].y));
+      }
+      // Generous slack so float rounding can never drop a tied site.
+      float bound = centreD + halfDiagonal + 1.0f;
+      for (size_t i = 0; i < length; ++i) {
+        if (boxDistance(points[i].x, points[i].y, x0, y0, x1, y1) > bound)
+          continue;
+        if (used == capacity) {
+          capacity *= 2;
+          int *grown =
+              (int *)realloc(grid->candidates, capacity * sizeof(int));
+          if (grown == NULL) {
+            perror("Failed to allocate memory for site grid");
+            free(grid->cellStart);
+            free(grid->candidates);
+            return false;
+          }
+          grid->candidates = grown;
+        }
+        grid->candidates[used++] = i;
+      }
+      grid->cellStart[gy * grid->cols + gx + 1] = used;
+    }
+  }
+  return true;
+}
+
+static void siteGridFree(SiteGrid *grid) {
+  free(grid->cellStart);
+  free(grid->candidates);
+}
+
+// Same result as closestDist for any pixel on the map, including ties going
+// to the lowest index, since candidates are kept in index order.
+static int siteGridClosest(const SiteGrid *grid, int x, int y) {
+  int c = (y / SITE_GRID_CELL) * grid->cols + x / SITE_GRID_CELL;
+  float closestD = FLT_MAX;
+  int closestIndex = -1;
+  for (int k = grid->cellStart[c]; k < grid->cellStart[c + 1]; ++k) {
+    int i = grid->candidates[k];
+    float d = distance(x, y, grid->points[i].x, grid->points[i].y);
+    if (closestD > d) {
+      closestD = d;
+      closestIndex = i;
+    }
+  }
+  return closestIndex;
+}
+
+static void crossCheck(const VoronoiLabels *voronoi, const Vector points[],
+                       size_t length) {
+  if (!VORONOI_CROSS_CHECK)
+    return;
+  size_t mismatches = voronoiCrossCheck(voronoi, points, length);
+  printf("Voronoi labels: %zu of %zu pixels differ from brute force\n",
+         mismatches, (size_t)voronoi->width * voronoi->height);
+}
+
+void generateVoronoiNoise(Heightmap *map, Vector layerPoints[],
+                          const float index, const size_t length,
+                          struct osn_context *ctx, const float bias_scale,
+                          const float rate, const Config *config) {
   // printf("generateVoronoiNoise called for index: %f, length: %zu\n", index,
   //        length);
   Vector offset;
   offset.x = (((float)(rand()) / RAND_MAX) * 20000) - 10000;
   offset.y = (((float)(rand()) / RAND_MAX) * 20000) - 10000;
+  VoronoiLabels voronoi;
+  bool haveLabels = VORONOI_LABEL_MAP &&
+                    voronoiLabelsInit(&voronoi, map->width, map->height);
+  if (haveLabels) {
+    voronoiLabel(&voronoi, layerPoints, length);
+    crossCheck(&voronoi, layerPoints, length);
+  }
+  SiteGrid grid = {0};
+  bool haveGrid = !haveLabels && siteGridInit(&grid, layerPoints, length,
+                                              map->width, map->height);
 
   for (size_t i = 0; i < length; ++i) {
     Vector point = layerPoints[i];
-    float r = (SIZE_MODIFIER * N_LAYERS / index);
+    float r = (config->sizeModifier * config->nLayers / index);
     int x0 = (int)max(0, point.x - r);
     int y0 = (int)max(0, point.y - r);
-    int xf = (int)min(WINDOW_WIDTH - 1, point.x + r);
-    int yf = (int)min(WINDOW_HEIGHT - 1, point.y + r);
-    for (int x = x0; x <= xf; ++x) {
-      for (int y = y0; y <= yf; ++y) {
+    int xf = (int)min(map->width - 1, point.x + r);
+    int yf = (int)min(map->height - 1, point.y + r);
+    for (int y = y0; y <= yf; ++y) {
+      float *row = heightmapRow(map, y);
+      for (int x = x0; x <= xf; ++x) {
         if (distance(x, y, point.x, point.y) > r)
           continue;
-        if (i != closestDist(x, y, layerPoints, length))
+        int owner = haveLabels ? voronoi.labels[y * map->width + x]
+                    : haveGrid ? siteGridClosest(&grid, x, y)
+                               : closestDist(x, y, layerPoints, length);
+        if (i != owner)
           continue;
         float noiseFactor = open_simplex_noise3(ctx, x * bias_scale + offset.x,
                                                 y * bias_scale + offset.y, i) *
                             1.5;
-        float inverDistanceValue =
-            (r == 0) ? 0 : r - distance(x, y, point.x, point.y) / r;
-        (map)[x][y] += ((inverDistanceValue + noiseFactor) * rate);
+        float d = haveLabels ? voronoi.distances[y * map->width + x]
+                             : distance(x, y, point.x, point.y);
+        float inverDistanceValue = (r == 0) ? 0 : r - d / r;
+        row[x] += ((inverDistanceValue + noiseFactor) * rate);
+      }
+    }
+  }
+  if (haveLabels)
+    voronoiLabelsFree(&voronoi);
+  if (haveGrid)
+    siteGridFree(&grid);
+}
+
+// Centroid sums are kept as exact integers so they do not depend on the order
+// pixels are visited in, which lets the fused and per-layer paths agree.
+static void moveTowardCentroids(Vector layerPoints[], const size_t length,
+                                const int64_t *sumX, const int64_t *sumY,
+                                const int64_t *counts, const float moveSpeed) {
+  for (size_t i = 0; i < length; ++i) {
+    Vector centroid;
+    if (counts[i] > 0) {
+      centroid.x = (double)sumX[i] / counts[i];
+      centroid.y = (double)sumY[i] / counts[i];
+    } else {
+      centroid.x = layerPoints[i].x;
+      centroid.y = layerPoints[i].y;
+    }
+    layerPoints[i].x = LERP(layerPoints[i].x + RAND_IN_RANGE(-10, 10),
+                            centroid.x, moveSpeed / length);
+    layerPoints[i].y = LERP(layerPoints[i].y + RAND_IN_RANGE(-10, 10),
+                            centroid.y, moveSpeed / length);
+  }
+}
+
+typedef struct {
+  const Vector *points;
+  size_t length;
+  int width, height;
+  size_t nBands;
+  int64_t *partials; // x sums, y sums and counts for each band
+} RelaxJob;
+
+static void relaxBand(const RelaxJob *job, size_t band) {
+  const Vector *layerPoints = job->points;
+  const size_t length = job->length;
+  int64_t *sumX = job->partials + band * length * 3;
+  int64_t *sumY = sumX + length;
+  int64_t *counts = sumY + length;
+  const size_t width = job->width;
+  size_t y0 = job->height * band / job->nBands;
+  size_t y1 = job->height * (band + 1) / job->nBands;
+
+  VoronoiRows rows;
+  int *labels = NULL;
+  bool haveLabels = VORONOI_LABEL_MAP &&
+                    voronoiRowsInit(&rows, layerPoints, length, width);
+  if (haveLabels) {
+    labels = (int *)calloc(width, sizeof(int));
+    if (labels == NULL) {
+      voronoiRowsFree(&rows);
+      haveLabels = false;
+    }
+  }
+
+  for (size_t y = y0; y < y1; ++y) {
+    if (haveLabels)
+      voronoiLabelRow(&rows, y, labels);
+    for (size_t x = 0; x < width; ++x) {
+      size_t closestIndex = 0;
+      if (haveLabels) {
+        closestIndex = labels[x];
+      } else {
+        float closestD = FLT_MAX;
+        for (size_t i = 0; i < length; i++) {
+          float d = distance(x, y, layerPoints[i].x, layerPoints[i].y);
+          if (d < closestD) {
+            closestD = d;
+            closestIndex = i;
+          }
+        }
       }
+
+      sumX[closestIndex] += x;
+      sumY[closestIndex] += y;
+      counts[closestIndex]++;
     }
   }
+  if (haveLabels) {
+    voronoiRowsFree(&rows);
+    free(labels);
+  }
+}
+
+static void relaxTask(void *arg, size_t begin, size_t end) {
+  for (size_t band = begin; band < end; ++band) {
+    relaxBand((const RelaxJob *)arg, band);
+  }
 }
 
-void relaxPoints(Vector layerPoints[], const size_t length) {
-  Vector *newPoints = (Vector *)calloc(length, sizeof(Vector));
-  if (newPoints == NULL) {
-    perror("Failed to allocate memory ofr newPoints");
+// Each band of rows sums into its own accumulators, which are reduced in
+// band order afterwards. The sums are exact integers, so the relaxed sites
+// are the same for every thread count.
+void relaxPoints(Vector layerPoints[], const size_t length,
+                 const Config *config) {
+  if (VORONOI_LABEL_MAP && VORONOI_CROSS_CHECK) {
+    VoronoiLabels voronoi;
+    if (voronoiLabelsInit(&voronoi, config->worldWidth, config->worldHeight)) {
+      voronoiLabel(&voronoi, layerPoints, length);
+      crossCheck(&voronoi, layerPoints, length);
+      voronoiLabelsFree(&voronoi);
+    }
+  }
+
+  size_t nBands = threadCount(config->nThreads);
+  int64_t *sums = (int64_t *)calloc((nBands + 1) * length * 3, sizeof(int64_t));
+  if (sums == NULL) {
+    perror("Failed to allocate memory for centroid sums");
     return;
   }
-  int *counts = (int *)calloc(length, sizeof(int));
-  if (counts == NULL) {
-    perror("Failed to allocate memory for counts");
-    free(newPoints);
+  RelaxJob job = {layerPoints,         length, config->worldWidth,
+                  config->worldHeight, nBands, sums + length * 3};
+  parallelFor(nBands, nBands, relaxTask, &job);
+  for (size_t band = 0; band < nBands; ++band) {
+    for (size_t k = 0; k < length * 3; ++k) {
+      sums[k] += job.partials[band * length * 3 + k];
+    }
+  }
+
+  moveTowardCentroids(layerPoints, length, sums, sums + length,
+                      sums + 2 * length, config->moveSpeed);
+  free(sums);
+}
+
+// State of one layer taking part in the fused pass. Owners come from the
+// same engine the per-layer functions use, so both paths agree exactly.
+struct ActiveLayer {
+  ContinentLayer *layer;
+  SiteGrid grid;
+  Vector offset;
+  float r;
+  size_t sumOffset; // start of this layer's sums in a band's accumulators
+};
+
+bool continents_init(Continents *continents, Vector **layers,
+                     const Config *config) {
+  const size_t nLayers = config->nLayers;
+  continents->nLayers = nLayers;
+  continents->active = NULL;
+  continents->layers =
+      (ContinentLayer *)calloc(nLayers, sizeof(ContinentLayer));
+  if (continents->layers == NULL) {
+    perror("Failed to allocate memory for continent layers");
+    return false;
+  }
+  for (size_t i = 0; i < nLayers; ++i) {
+    ContinentLayer *layer = &continents->layers[i];
+    layer->points = layers[i];
+    layer->length = config->nStartPoints + i;
+    layer->sums = (int64_t *)calloc(layer->length * 3, sizeof(int64_t));
+    if (layer->sums == NULL) {
+      perror("Failed to allocate memory for centroid sums");
+      free_continents(continents);
+      return false;
+    }
+    layer->centroidsValid = false;
+  }
+  continents->active =
+      (ActiveLayer *)calloc(nLayers, sizeof(ActiveLayer));
+  if (continents->active == NULL) {
+    perror("Failed to allocate memory for active layers");
+    free_continents(continents);
+    return false;
+  }
+  continents->nActive = 0;
+  continents->nextRow = -1;
+  return true;
+}
+
+void free_continents(Continents *continents) {
+  if (continents->layers == NULL)
     return;
+  for (size_t i = 0; i < continents->nLayers; ++i) {
+    free(continents->layers[i].sums);
   }
+  free(continents->layers);
+  continents->layers = NULL;
+  free(continents->active);
+  continents->active = NULL;
+}
 
-  for (size_t i = 0; i < length; ++i) {
-    newPoints[i].x = 0;
-    newPoints[i].y = 0;
-    counts[i] = 0;
+typedef struct {
+  Heightmap *map;
+  ActiveLayer *active;
+  size_t nActive;
+  bool contribute;
+  struct osn_context *ctx;
+  float bias_scale;
+  float rate;
+  int y0, y1; // rows of this pass, split into nBands bands
+  size_t nBands;
+  size_t bandSums;
+  int64_t *partials;
+  bool *ok; // per band, set once the band has run all its rows
+} ContinentJob;
+
+static void resolveOwners(ActiveLayer *active, VoronoiRows *rows, int width,
+                          int y, int *owners) {
+  if (VORONOI_LABEL_MAP) {
+    voronoiLabelRow(rows, y, owners);
+  } else {
+    for (int x = 0; x < width; ++x) {
+      owners[x] = siteGridClosest(&active->grid, x, y);
+    }
   }
+}
 
-  for (size_t x = 0; x < WINDOW_WIDTH; ++x) {
-    for (size_t y = 0; y < WINDOW_HEIGHT; ++y) {
-      float closestD = FLT_MAX;
-      size_t closestIndex = 0;
+// Walks one band of rows, a row at a time since rows are contiguous in the
+// Heightmap. For each row the owners of every active layer are resolved into
+// a small strip that stays in cache, then every pixel adds
+// itself to the band's centroid sums for each layer and, with contribute
+// set, adds each owner's noise and inverse distance in layer order, exactly
+// as successive generateVoronoiNoise calls would. A band that cannot get
+// its strips runs no rows and leaves its ok flag clear.
+static void continentBand(const ContinentJob *job, size_t band) {
+  Heightmap *map = job->map;
+  ActiveLayer *active = job->active;
+  size_t nActive = job->nActive;
+  const bool contribute = job->contribute;
+  struct osn_context *ctx = job->ctx;
+  const float bias_scale = job->bias_scale;
+  const float rate = job->rate;
+  const int width = map->width, height = map->height;
+  int *owners = (int *)calloc(nActive * width, sizeof(int));
+  VoronoiRows *rows = (VoronoiRows *)calloc(nActive, sizeof(VoronoiRows));
+  if (owners == NULL || rows == NULL) {
+    perror("Failed to allocate memory for owner strips");
+    free(owners);
+    free(rows);
+    return;
+  }
+  size_t built = 0;
+  if (VORONOI_LABEL_MAP) {
+    for (; built < nActive; ++built) {
+      if (!voronoiRowsInit(&rows[built], active[built].layer->points,
+                           active[built].layer->length, width))
+        break;
+    }
+  }
+
+  int64_t *partial = job->partials + band * job->bandSums;
+  const int span = job->y1 - job->y0;
+  int y0 = job->y0 + span * band / job->nBands;
+  int y1 = job->y0 + span * (band + 1) / job->nBands;
+  const bool ok = !VORONOI_LABEL_MAP || built == nActive;
+  if (!ok)
+    y1 = y0;
+  for (int y = y0; y < y1; ++y) {
+    for (size_t a = 0; a < nActive; ++a) {
+      resolveOwners(&active[a], &rows[a], width, y, owners + a * width);
+    }
+    float *row = heightmapRow(map, y);
+    for (int x = 0; x < width; ++x) {
+      float value = contribute ? row[x] : 0;
+      for (size_t a = 0; a < nActive; ++a) {
+        ContinentLayer *layer = active[a].layer;
+        int i = owners[a * width + x];
+        if (i < 0)
+          continue;
+        int64_t *sumX = partial + active[a].sumOffset;
+        int64_t *sumY = sumX + layer->length;
+        int64_t *counts = sumY + layer->length;
+        sumX[i] += x;
+        sumY[i] += y;
+        counts[i]++;
+        if (!contribute)
+          continue;
+
+        Vector point = layer->points[i];
+        float r = active[a].r;
+        // Same box and radius tests as generateVoronoiNoise.
+        if (x < (int)max(0, point.x - r) || y < (int)max(0, point.y - r) ||
+            x > (int)min(width - 1, point.x + r) ||
+            y > (int)min(height - 1, point.y + r))
+          continue;
+        float d = distance(x, y, point.x, point.y);
+        if (d > r)
+          continue;
+        Vector offset = active[a].offset;
+        float noiseFactor = open_simplex_noise3(ctx, x * bias_scale + offset.x,
+                                                y * bias_scale + offset.y, i) *
+                            1.5;
+        float inverDistanceValue = (r == 0) ? 0 : r - d / r;
+        value += ((inverDistanceValue + noiseFactor) * rate);
+      }
+      if (contribute)
+        row[x] = value;
+    }
+  }
 
-      for (size_t i = 0; i < length; i++) {
-        float d = distance(x, y, layerPoints[i].x, layerPoints[i].y);
-        if (d < closestD) {
-          closestD = d;
-          closestIndex = i;
+  for (size_t a = 0; a < built; ++a) {
+    voronoiRowsFree(&rows[a]);
+  }
+  free(rows);
+  free(owners);
+  job->ok[band] = ok;
+}
+
+static void continentTask(void *arg, size_t begin, size_t end) {
+  for (size_t band = begin; band < end; ++band) {
+    continentBand((const ContinentJob *)arg, band);
+  }
+}
+
+// Runs rows [y0, y1) as bands on nThreads threads and adds their centroid
+// sums into each layer in band order. Returns false if any band failed, as
+// the sums then miss its rows.
+static bool continentPass(Heightmap *map, ActiveLayer *active, size_t nActive,
+                          bool contribute, struct osn_context *ctx,
+                          const float bias_scale, const float rate,
+                          const size_t nThreads, int y0, int y1) {
+  if (!VORONOI_LABEL_MAP) {
+    for (size_t a = 0; a < nActive; ++a) {
+      ContinentLayer *layer = active[a].layer;
+      if (!siteGridInit(&active[a].grid, layer->points, layer->length,
+                        map->width, map->height)) {
+        for (size_t k = 0; k < a; ++k) {
+          siteGridFree(&active[k].grid);
         }
+        return false;
       }
+    }
+  }
 
-      newPoints[closestIndex].x += x;
-      newPoints[closestIndex].y += y;
-      counts[closestIndex]++;
+  size_t bandSums = 0;
+  for (size_t a = 0; a < nActive; ++a) {
+    active[a].sumOffset = bandSums;
+    bandSums += active[a].layer->length * 3;
+  }
+  size_t nBands = threadCount(nThreads);
+  if (nBands > (size_t)(y1 - y0))
+    nBands = y1 - y0;
+  ContinentJob job = {.map = map,
+                      .active = active,
+                      .nActive = nActive,
+                      .contribute = contribute,
+                      .ctx = ctx,
+                      .bias_scale = bias_scale,
+                      .rate = rate,
+                      .y0 = y0,
+                      .y1 = y1,
+                      .nBands = nBands,
+                      .bandSums = bandSums};
+  job.partials = (int64_t *)calloc(nBands * bandSums, sizeof(int64_t));
+  job.ok = (bool *)calloc(nBands, sizeof(bool));
+  bool ok = job.partials != NULL && job.ok != NULL;
+  if (ok) {
+    parallelFor(nBands, nBands, continentTask, &job);
+    for (size_t band = 0; band < nBands; ++band) {
+      ok = ok && job.ok[band];
+    }
+    for (size_t a = 0; a < nActive; ++a) {
+      ContinentLayer *layer = active[a].layer;
+      for (size_t band = 0; band < nBands; ++band) {
+        const int64_t *partial =
+            job.partials + band * bandSums + active[a].sumOffset;
+        for (size_t k = 0; k < layer->length * 3; ++k) {
+          layer->sums[k] += partial[k];
+        }
+      }
     }
+  } else {
+    perror("Failed to allocate memory for centroid sums");
   }
 
-  for (size_t i = 0; i < length; ++i) {
-    if (counts > 0) {
-      newPoints[i].x /= counts[i];
-      newPoints[i].y /= counts[i];
+  if (!VORONOI_LABEL_MAP) {
+    for (size_t a = 0; a < nActive; ++a) {
+      siteGridFree(&active[a].grid);
+    }
+  }
+  free(job.partials);
+  free(job.ok);
+  return ok;
+}
+
+static void clearSums(ActiveLayer *active, size_t nActive) {
+  for (size_t a = 0; a < nActive; ++a) {
+    ContinentLayer *layer = active[a].layer;
+    memset(layer->sums, 0, layer->length * 3 * sizeof(int64_t));
+  }
+}
+
+// Relaxes every layer taking part in this iteration toward its centroids and
+// draws its noise offsets, ready for the contributing pass.
+static void startContributing(Continents *continents, size_t iteration,
+                              const Config *config) {
+  ActiveLayer *active = continents->active;
+  size_t nActive = 0;
+  for (size_t i = 0; i < continents->nLayers; ++i) {
+    if (iteration % (i + 1) != 0)
+      continue;
+    ContinentLayer *layer = &continents->layers[i];
+    moveTowardCentroids(layer->points, layer->length, layer->sums,
+                        layer->sums + layer->length,
+                        layer->sums + 2 * layer->length, config->moveSpeed);
+    ActiveLayer *a = &active[nActive++];
+    a->layer = layer;
+    a->offset.x = (((float)(rand()) / RAND_MAX) * 20000) - 10000;
+    a->offset.y = (((float)(rand()) / RAND_MAX) * 20000) - 10000;
+    a->r = (config->sizeModifier * config->nLayers / (float)(i + 1));
+  }
+  continents->nActive = nActive;
+  continents->contribute = true;
+  continents->summed = true;
+  continents->nextRow = 0;
+  clearSums(active, nActive);
+}
+
+// Fused equivalent of running relaxPoints and generateVoronoiNoise for every
+// layer i with iteration % (i + 1) == 0. Centroid sums gathered while adding
+// a layer's contributions describe its sites until they next move, so the
+// following relaxation of that layer needs no extra pass; only layers that
+// have never been summed get a centroid-only pass first.
+//
+// The work is split so it can be resumed: each call runs up to rows rows of
+// the current pass and returns true once the iteration's continents are
+// done. Rows are independent and the centroid sums are exact integers, so
+// the map comes out the same however the rows are split.
+bool continentsRows(Continents *continents, Heightmap *map, int rows,
+                    const size_t iteration, struct osn_context *ctx,
+                    const float bias_scale, const float rate,
+                    const Config *config) {
+  ActiveLayer *active = continents->active;
+  if (continents->nextRow < 0) {
+    size_t nStale = 0;
+    for (size_t i = 0; i < continents->nLayers; ++i) {
+      if (iteration % (i + 1) != 0)
+        continue;
+      if (!continents->layers[i].centroidsValid)
+        active[nStale++].layer = &continents->layers[i];
+    }
+    if (nStale == 0) {
+      startContributing(continents, iteration, config);
     } else {
-      newPoints[i].x = layerPoints[i].x;
-      newPoints[i].y = layerPoints[i].y;
+      continents->nActive = nStale;
+      continents->contribute = false;
+      continents->summed = true;
+      continents->nextRow = 0;
+      clearSums(active, nStale);
     }
-    layerPoints[i].x = LERP(layerPoints[i].x + RAND_IN_RANGE(-10, 10),
-                            newPoints[i].x, MOVE_SPEED / length);
-    layerPoints[i].y = LERP(layerPoints[i].y + RAND_IN_RANGE(-10, 10),
-                            newPoints[i].y, MOVE_SPEED / length);
   }
-  free(newPoints);
-  free(counts);
+
+  int y0 = continents->nextRow;
+  int y1 = rows < map->height - y0 ? y0 + rows : map->height;
+  if (!continentPass(map, active, continents->nActive,
+                     continents->contribute, ctx, bias_scale, rate,
+                     config->nThreads, y0, y1)) {
+    continents->summed = false;
+  }
+  continents->nextRow = y1;
+  if (y1 < map->height)
+    return false;
+
+  if (!continents->contribute) {
+    // Partial sums would pull the sites toward wrong centroids; with none,
+    // the stale layers only take their random step.
+    if (!continents->summed)
+      clearSums(active, continents->nActive);
+    startContributing(continents, iteration, config);
+    return false;
+  }
+  for (size_t a = 0; a < continents->nActive; ++a) {
+    active[a].layer->centroidsValid = continents->summed;
+  }
+  continents->nextRow = -1;
+  return true;
+}
+
+void generateContinents(Continents *continents, Heightmap *map,
+                        const size_t iteration, struct osn_context *ctx,
+                        const float bias_scale, const float rate,
+                        const Config *config) {
+  while (!continentsRows(continents, map, map->height, iteration, ctx,
+                         bias_scale, rate, config)) {
+  }
 }
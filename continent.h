@@ -1,9 +1,47 @@
 #pragma once
 
 #include "common.h"
+#include "config.h"
+#include "heightmap.h"
 #include "open-simplex-noise.h"
+#include <stdint.h>
 
-void generateVoronoiNoise(float **map, Vector layerPoints[], const float index,
-                          const size_t length, struct osn_context *ctx,
-                          const float bias_scale, const float rate);
-void relaxPoints(Vector layerPoints[], const size_t length);
+typedef struct {
+  Vector *points;
+  size_t length;
+  int64_t *sums; // centroid x sums, y sums and pixel counts, length each
+  bool centroidsValid;
+} ContinentLayer;
+
+typedef struct ActiveLayer ActiveLayer;
+
+// Layers, plus the state of an iteration that continentsRows has started
+// but not finished: the layers in the current pass, whether it adds to the
+// map or only sums centroids, and the next row to run (-1 when idle).
+typedef struct {
+  ContinentLayer *layers;
+  size_t nLayers;
+  ActiveLayer *active;
+  size_t nActive;
+  bool contribute;
+  bool summed;
+  int nextRow;
+} Continents;
+
+void generateVoronoiNoise(Heightmap *map, Vector layerPoints[],
+                          const float index, const size_t length,
+                          struct osn_context *ctx, const float bias_scale,
+                          const float rate, const Config *config);
+void relaxPoints(Vector layerPoints[], const size_t length,
+                 const Config *config);
+bool continents_init(Continents *continents, Vector **layers,
+                     const Config *config);
+void free_continents(Continents *continents);
+void generateContinents(Continents *continents, Heightmap *map,
+                        const size_t iteration, struct osn_context *ctx,
+                        const float bias_scale, const float rate,
+                        const Config *config);
+bool continentsRows(Continents *continents, Heightmap *map, int rows,
+                    const size_t iteration, struct osn_context *ctx,
+                    const float bias_scale, const float rate,
+                    const Config *config);
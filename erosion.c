@@ -1,7 +1,11 @@
 #include "erosion.h"
 #include "common.h"
+#include "parallel.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -12,81 +16,102 @@ typedef struct {
   float gradientY;
 } HeightAndGradient;
 
+// Brushes only differ near the map edges, where they are clipped. A cell's
+// brush is picked by how far (capped at the brush radius) it is from each
+// edge, so every interior cell shares one kernel and the few clipped variants
+// sit in the same contiguous table.
+static int brushClass(const Erosion *erosion, int centerX, int centerY) {
+  int clip = erosion->radius + 1;
+  int left = MIN(centerX, erosion->radius);
+  int right = MIN(erosion->width - 1 - centerX, erosion->radius);
+  int top = MIN(centerY, erosion->radius);
+  int bottom = MIN(erosion->height - 1 - centerY, erosion->radius);
+  return ((left * clip + right) * clip + top) * clip + bottom;
+}
+
 static void initalizeBrushIndicies(Erosion *erosion) {
-  erosion->erosionBrushIndicies =
-      (int **)calloc(WINDOW_WIDTH * WINDOW_HEIGHT, sizeof(int *));
-  erosion->erosionBrushWeights =
-      (float **)calloc(WINDOW_WIDTH * WINDOW_HEIGHT, sizeof(float *));
-  erosion->lengths =
-      (size_t *)calloc(WINDOW_WIDTH * WINDOW_HEIGHT, sizeof(size_t));
-
-  int *xOffsets =
-      (int *)calloc(EROSION_RADIUS * EROSION_RADIUS * 4, sizeof(int));
-  int *yOffsets =
-      (int *)calloc(EROSION_RADIUS * EROSION_RADIUS * 4, sizeof(int));
-  float *weights =
-      (float *)calloc(EROSION_RADIUS * EROSION_RADIUS * 4, sizeof(float));
-  float weightSum = 0;
+  const int radius = erosion->radius;
+  const int clip = radius + 1;
+  const int classes = clip * clip * clip * clip;
+  int kernelSize = (2 * radius + 1) * (2 * radius + 1);
+  erosion->brushStarts = (int *)malloc((classes + 1) * sizeof(int));
+  erosion->brushOffsets = (int *)malloc(classes * kernelSize * sizeof(int));
+  erosion->brushWeights =
+      (float *)malloc(classes * kernelSize * sizeof(float));
+  if (!erosion->brushStarts || !erosion->brushOffsets ||
+      !erosion->brushWeights) {
+    fprintf(stderr, "Memory allocation failed for erosion brushes.\n");
+    exit(EXIT_FAILURE);
+  }
+
   int addIndex = 0;
+  int brush = 0;
+  for (int left = 0; left < clip; ++left) {
+    for (int right = 0; right < clip; ++right) {
+      for (int top = 0; top < clip; ++top) {
+        for (int bottom = 0; bottom < clip; ++bottom) {
+          int start = addIndex;
+          float weightSum = 0;
+          // Loop order matches brushClass(), so classes are stored in order.
+          erosion->brushStarts[brush++] = start;
 
-  for (size_t i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; ++i) {
-    int centerX = i % WINDOW_WIDTH;
-    int centerY = i / WINDOW_WIDTH;
-
-    if (centerY <= EROSION_RADIUS ||
-        centerY >= WINDOW_HEIGHT - EROSION_RADIUS ||
-        centerX <= EROSION_RADIUS + 1 ||
-        centerX >= WINDOW_WIDTH - EROSION_RADIUS) {
-      weightSum = 0;
-      addIndex = 0;
-
-      for (int y = -EROSION_RADIUS; y <= EROSION_RADIUS; ++y) {
-        for (int x = -EROSION_RADIUS; x <= EROSION_RADIUS; ++x) {
-          float sqrDst = x * x + y * y;
-          if (sqrDst < EROSION_RADIUS * EROSION_RADIUS) {
-            int cordX = centerX + x;
-            int cordY = centerY + y;
-
-            if (cordX >= 0 && cordX < WINDOW_WIDTH && cordY >= 0 &&
-                cordY < WINDOW_HEIGHT) {
-              float weight = 1 - sqrt(sqrDst) / EROSION_RADIUS;
-              weightSum += weight;
-              weights[addIndex] = weight;
-              xOffsets[addIndex] = x;
-              yOffsets[addIndex] = y;
-              addIndex++;
+          for (int y = -radius; y <= radius; ++y) {
+            for (int x = -radius; x <= radius; ++x) {
+              float sqrDst = x * x + y * y;
+              if (sqrDst < radius * radius && x >= -left && x <= right &&
+                  y >= -top && y <= bottom) {
+                float weight = 1 - sqrt(sqrDst) / radius;
+                weightSum += weight;
+                erosion->brushWeights[addIndex] = weight;
+                erosion->brushOffsets[addIndex] = y * erosion->width + x;
+                addIndex++;
+              }
             }
           }
+          for (int j = start; j < addIndex; ++j) {
+            erosion->brushWeights[j] /= weightSum;
+          }
         }
       }
-      int numEntries = addIndex;
-      erosion->erosionBrushIndicies[i] = (int *)calloc(numEntries, sizeof(int));
-      erosion->erosionBrushWeights[i] =
-          (float *)calloc(numEntries, sizeof(float));
-      erosion->lengths[i] = numEntries;
-
-      for (size_t j = 0; j < numEntries; ++j) {
-        erosion->erosionBrushIndicies[i][j] =
-            (yOffsets[j] + centerY) * WINDOW_WIDTH + xOffsets[j] + centerX;
-        erosion->erosionBrushWeights[i][j] = weights[j] / weightSum;
-      }
     }
   }
+  erosion->brushStarts[classes] = addIndex;
+}
 
-  free(xOffsets);
-  free(yOffsets);
-  free(weights);
+// Sets up erosion for a width x height map with the given brush radius and
+// droplet lifetime. The pyramid uses this for its downsampled levels.
+static void erodeInitLevel(Erosion *erosion, int width, int height, int radius,
+                           int lifetime) {
+  erosion->width = width;
+  erosion->height = height;
+  erosion->radius = radius;
+  erosion->lifetime = lifetime;
+  initalizeBrushIndicies(erosion);
+  erosion->sortSpawns = SORTED_SPAWNS;
+  erosion->holdSpawns = false;
+  erosion->spawnsHeld = false;
+  erosion->spawnCells =
+      (int *)malloc((size_t)(width - 1) * (height - 1) * sizeof(int));
+  if (!erosion->spawnCells) {
+    fprintf(stderr, "Memory allocation failed for erosion spawn table.\n");
+    exit(EXIT_FAILURE);
+  }
 }
 
-void erode_init(Erosion *erosion) { initalizeBrushIndicies(erosion); }
+void erode_init(Erosion *erosion, const Config *config) {
+  erodeInitLevel(erosion, config->worldWidth, config->worldHeight,
+                 config->erosionRadius, config->dropletLifetime);
+}
 
 void free_erode(Erosion *erosion) {
-  free(erosion->erosionBrushWeights);
-  free(erosion->erosionBrushIndicies);
-  free(erosion->lengths);
+  free(erosion->brushStarts);
+  free(erosion->brushOffsets);
+  free(erosion->brushWeights);
+  free(erosion->spawnCells);
 }
 
-static HeightAndGradient calculateHeightAndGradient(float *map, float posX,
+static HeightAndGradient calculateHeightAndGradient(const float *map,
+                                                    int width, float posX,
                                                     float posY) {
   int cordX = (int)posX;
   int cordY = (int)posY;
@@ -94,11 +119,11 @@ static HeightAndGradient calculateHeightAndGradient(float *map, float posX,
   float x = posX - cordX;
   float y = posY - cordY;
 
-  int nodeIndexNW = cordY * WINDOW_WIDTH + cordX;
+  int nodeIndexNW = cordY * width + cordX;
   float heightNW = map[nodeIndexNW];
   float heightNE = map[nodeIndexNW + 1];
-  float heightSW = map[nodeIndexNW + WINDOW_WIDTH];
-  float heightSE = map[nodeIndexNW + WINDOW_WIDTH + 1];
+  float heightSW = map[nodeIndexNW + width];
+  float heightSE = map[nodeIndexNW + width + 1];
 
   float gradientX = (heightNE - heightNW) * (1 - y) + (heightSE - heightSW) * y;
   float gradientY = (heightSW - heightNW) * (1 - x) + (heightSE - heightNE) * x;
@@ -110,93 +135,1201 @@ static HeightAndGradient calculateHeightAndGradient(float *map, float posX,
   return result;
 }
 
-void erode(Erosion *erosion, float *map, int numIterations, float sealevel) {
-  int c = numIterations + 1;
-  if (numIterations >= 100) {
-    c = (int)numIterations / 100;
-  }
-  for (size_t iteration = 0; iteration < numIterations; ++iteration) {
-    if (iteration % c == 0) {
-      printf("%zu\n", iteration);
-    }
-    float posX = RAND_IN_RANGE(0, WINDOW_WIDTH - 1);
-    float posY = RAND_IN_RANGE(0, WINDOW_HEIGHT - 1);
-    while (posX < 0 || posY < 0 ||
-           (map[(int)posX + (int)posY * WINDOW_WIDTH] < sealevel &&
-            rand() % 2 == 0)) {
-      posX = RAND_IN_RANGE(0, WINDOW_WIDTH - 1);
-      posY = RAND_IN_RANGE(0, WINDOW_HEIGHT - 1);
-    }
-    float dirX = 0, dirY = 0;
-    float speed = INITAL_SPEED;
-    float water = INITIAL_WATER_VOLUME;
-    float sediment = 0;
-    for (size_t lifetime = 0; lifetime < MAX_DROPLET_LIFETIME; ++lifetime) {
-      int nodeX = (int)posX;
-      int nodeY = (int)posY;
-      int dropletIndex = nodeY * WINDOW_WIDTH + nodeX;
-
-      float cellOffsetX = posX - nodeX;
-      float cellOffsetY = posY - nodeY;
-      HeightAndGradient heightAndGradient =
-          calculateHeightAndGradient(map, posX, posY);
-
-      dirX = dirX * INERTIA - heightAndGradient.gradientX * (1 - INERTIA);
-      dirY = dirY * INERTIA - heightAndGradient.gradientY * (1 - INERTIA);
-
-      float len = sqrt(dirX * dirX + dirY * dirY);
-      if (len != 0) {
-        dirX /= len;
-        dirY /= len;
+// Deposits or erodes amount around the droplet's cell and returns the droplet's
+// new sediment load. Always inlined so the AVX2 engine gets its own VEX copy;
+// calling legacy SSE code with live ymm state stalls on every transition.
+static inline __attribute__((always_inline)) float
+depositOrErode(const Erosion *erosion, float *map, int nodeX, int nodeY,
+               float cellOffsetX, float cellOffsetY, bool deposit, float amount,
+               float sediment) {
+  const int width = erosion->width;
+  int dropletIndex = nodeY * width + nodeX;
+  if (deposit) {
+    sediment -= amount;
+    (map)[dropletIndex] += amount * (1 - cellOffsetX) * (1 - cellOffsetY);
+    (map)[dropletIndex + 1] += amount * cellOffsetX * (1 - cellOffsetY);
+    (map)[dropletIndex + width] += amount * (1 - cellOffsetX) * cellOffsetY;
+    (map)[dropletIndex + width + 1] += amount * cellOffsetX * cellOffsetY;
+    return sediment;
+  }
+  int brush = brushClass(erosion, nodeX, nodeY);
+  const int *offsets = erosion->brushOffsets;
+  const float *weights = erosion->brushWeights;
+  for (int brushPointIndex = erosion->brushStarts[brush];
+       brushPointIndex < erosion->brushStarts[brush + 1]; ++brushPointIndex) {
+    int nodeIndex = dropletIndex + offsets[brushPointIndex];
+    float weightErodeAmount = amount * weights[brushPointIndex];
+    float deltaSediment = ((map)[nodeIndex] < weightErodeAmount)
+                              ? (map)[nodeIndex]
+                              : weightErodeAmount;
+    (map)[nodeIndex] -= deltaSediment;
+    sediment += deltaSediment;
+  }
+  return sediment;
+}
+
+// Runs one droplet from (posX, posY) until it evaporates or leaves the map.
+// A droplet moves at most one cell per step, so everything it reads or writes
+// stays within dropletReach() cells of where it spawned.
+static void simulateDroplet(const Erosion *erosion, float *map, float posX,
+                            float posY) {
+  float dirX = 0, dirY = 0;
+  float speed = INITAL_SPEED;
+  float water = INITIAL_WATER_VOLUME;
+  float sediment = 0;
+  for (int lifetime = 0; lifetime < erosion->lifetime; ++lifetime) {
+    int nodeX = (int)posX;
+    int nodeY = (int)posY;
+
+    float cellOffsetX = posX - nodeX;
+    float cellOffsetY = posY - nodeY;
+    HeightAndGradient heightAndGradient =
+        calculateHeightAndGradient(map, erosion->width, posX, posY);
+
+    dirX = dirX * INERTIA - heightAndGradient.gradientX * (1 - INERTIA);
+    dirY = dirY * INERTIA - heightAndGradient.gradientY * (1 - INERTIA);
+
+    float len = sqrt(dirX * dirX + dirY * dirY);
+    if (len != 0) {
+      dirX /= len;
+      dirY /= len;
+    }
+    posX += dirX;
+    posY += dirY;
+
+    if ((dirX == 0 && dirY == 0) || posX < 0 || posX >= erosion->width - 1 ||
+        posY < 0 || posY >= erosion->height - 1) {
+      break;
+    }
+    float newHeight =
+        calculateHeightAndGradient(map, erosion->width, posX, posY).height;
+    float deltaHeight = newHeight - heightAndGradient.height;
+
+    float sedimentCapcity =
+        MAX(-deltaHeight * speed * water * SEDIMENT_CAPACITY_FACTOR,
+            MIN_SEDIMENT_CAPACITY);
+
+    bool deposit = sediment > sedimentCapcity || deltaHeight > 0;
+    float amount;
+    if (deposit) {
+      amount = (deltaHeight > 0) ? MIN(deltaHeight, sediment)
+                                 : (sediment - sedimentCapcity) * DEPOSIT_SPEED;
+    } else {
+      amount = MIN((sedimentCapcity - sediment) * ERODE_SPEED, -deltaHeight);
+    }
+    sediment = depositOrErode(erosion, map, nodeX, nodeY, cellOffsetX,
+                              cellOffsetY, deposit, amount, sediment);
+
+    speed = sqrt(speed * speed + deltaHeight * GRAVITY);
+    water *= (1 - EVAPORATE_SPEED);
+  }
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define DROPLET_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define DROPLET_LANES 8
+
+#ifdef DROPLET_SIMD
+// Bilinear height and gradient of up to eight droplets from gathered corner
+// heights. Lanes outside mask read cell 0 and are ignored by the caller.
+__attribute__((target("avx2"))) static void
+gatherHeightAndGradient(const float *map, int width, __m256 posX, __m256 posY,
+                        __m256 mask, __m256 *height, __m256 *gradientX,
+                        __m256 *gradientY) {
+  __m256i nodeX = _mm256_cvttps_epi32(posX);
+  __m256i nodeY = _mm256_cvttps_epi32(posY);
+  __m256 x = _mm256_sub_ps(posX, _mm256_cvtepi32_ps(nodeX));
+  __m256 y = _mm256_sub_ps(posY, _mm256_cvtepi32_ps(nodeY));
+  __m256i index = _mm256_add_epi32(
+      _mm256_mullo_epi32(nodeY, _mm256_set1_epi32(width)), nodeX);
+  index = _mm256_and_si256(index, _mm256_castps_si256(mask));
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 heightNW = _mm256_i32gather_ps(map, index, 4);
+  __m256 heightNE = _mm256_i32gather_ps(
+      map, _mm256_add_epi32(index, _mm256_set1_epi32(1)), 4);
+  __m256 heightSW = _mm256_i32gather_ps(
+      map, _mm256_add_epi32(index, _mm256_set1_epi32(width)), 4);
+  __m256 heightSE = _mm256_i32gather_ps(
+      map, _mm256_add_epi32(index, _mm256_set1_epi32(width + 1)), 4);
+  __m256 ix = _mm256_sub_ps(one, x);
+  __m256 iy = _mm256_sub_ps(one, y);
+
+  if (gradientX != NULL) {
+    *gradientX =
+        _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(heightNE, heightNW), iy),
+                      _mm256_mul_ps(_mm256_sub_ps(heightSE, heightSW), y));
+    *gradientY =
+        _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(heightSW, heightNW), ix),
+                      _mm256_mul_ps(_mm256_sub_ps(heightSE, heightNE), x));
+  }
+  // Summed in the same order as calculateHeightAndGradient.
+  __m256 sum = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(heightNW, ix), iy),
+                             _mm256_mul_ps(_mm256_mul_ps(heightNE, x), iy));
+  sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_mul_ps(heightSW, ix), y));
+  *height = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_mul_ps(heightSE, x), y));
+}
+
+// Advances up to eight droplets in lockstep, one lane each. Movement and the
+// bilinear samples are vectorised; the deposit/erode scatter then runs lane
+// by lane in order, so droplets that hit the same cells in a step still see
+// each other's writes. Lanes that die are masked out of the later steps.
+__attribute__((target("avx2"))) static void
+simulateDropletsAVX2(const Erosion *erosion, float *map, const float *startX,
+                     const float *startY, int count) {
+  float laneX[DROPLET_LANES] = {0}, laneY[DROPLET_LANES] = {0};
+  int32_t laneAlive[DROPLET_LANES] = {0};
+  for (int l = 0; l < count; ++l) {
+    laneX[l] = startX[l];
+    laneY[l] = startY[l];
+    laneAlive[l] = -1;
+  }
+  __m256 posX = _mm256_loadu_ps(laneX);
+  __m256 posY = _mm256_loadu_ps(laneY);
+  __m256 alive = _mm256_castsi256_ps(_mm256_loadu_si256((__m256i *)laneAlive));
+  __m256 dirX = _mm256_setzero_ps(), dirY = _mm256_setzero_ps();
+  __m256 speed = _mm256_set1_ps(INITAL_SPEED);
+  __m256 water = _mm256_set1_ps(INITIAL_WATER_VOLUME);
+  __m256 sediment = _mm256_setzero_ps();
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 maxX = _mm256_set1_ps(erosion->width - 1);
+  const __m256 maxY = _mm256_set1_ps(erosion->height - 1);
+
+  for (int lifetime = 0; lifetime < erosion->lifetime; ++lifetime) {
+    if (_mm256_movemask_ps(alive) == 0)
+      break;
+    __m256 height, gradientX, gradientY;
+    gatherHeightAndGradient(map, erosion->width, posX, posY, alive, &height,
+                            &gradientX, &gradientY);
+    __m256 oldX = posX, oldY = posY;
+
+    dirX = _mm256_sub_ps(_mm256_mul_ps(dirX, _mm256_set1_ps(INERTIA)),
+                         _mm256_mul_ps(gradientX, _mm256_set1_ps(1 - INERTIA)));
+    dirY = _mm256_sub_ps(_mm256_mul_ps(dirY, _mm256_set1_ps(INERTIA)),
+                         _mm256_mul_ps(gradientY, _mm256_set1_ps(1 - INERTIA)));
+    __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dirX, dirX),
+                                              _mm256_mul_ps(dirY, dirY)));
+    __m256 moving = _mm256_cmp_ps(len, zero, _CMP_NEQ_OQ);
+    dirX = _mm256_blendv_ps(dirX, _mm256_div_ps(dirX, len), moving);
+    dirY = _mm256_blendv_ps(dirY, _mm256_div_ps(dirY, len), moving);
+    posX = _mm256_add_ps(posX, dirX);
+    posY = _mm256_add_ps(posY, dirY);
+
+    __m256 stopped = _mm256_and_ps(_mm256_cmp_ps(dirX, zero, _CMP_EQ_OQ),
+                                   _mm256_cmp_ps(dirY, zero, _CMP_EQ_OQ));
+    __m256 inside =
+        _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(posX, zero, _CMP_GE_OQ),
+                                    _mm256_cmp_ps(posX, maxX, _CMP_LT_OQ)),
+                      _mm256_and_ps(_mm256_cmp_ps(posY, zero, _CMP_GE_OQ),
+                                    _mm256_cmp_ps(posY, maxY, _CMP_LT_OQ)));
+    alive = _mm256_andnot_ps(stopped, _mm256_and_ps(alive, inside));
+    if (_mm256_movemask_ps(alive) == 0)
+      break;
+
+    __m256 newHeight;
+    gatherHeightAndGradient(map, erosion->width, posX, posY, alive, &newHeight,
+                            NULL, NULL);
+    __m256 deltaHeight = _mm256_sub_ps(newHeight, height);
+    __m256 carried = _mm256_mul_ps(
+        _mm256_mul_ps(_mm256_sub_ps(zero, deltaHeight), speed), water);
+    __m256 sedimentCapacity = _mm256_max_ps(
+        _mm256_mul_ps(carried, _mm256_set1_ps(SEDIMENT_CAPACITY_FACTOR)),
+        _mm256_set1_ps(MIN_SEDIMENT_CAPACITY));
+    __m256 rising = _mm256_cmp_ps(deltaHeight, zero, _CMP_GT_OQ);
+    __m256 deposit = _mm256_or_ps(
+        _mm256_cmp_ps(sediment, sedimentCapacity, _CMP_GT_OQ), rising);
+    __m256 amountToDeposit = _mm256_blendv_ps(
+        _mm256_mul_ps(_mm256_sub_ps(sediment, sedimentCapacity),
+                      _mm256_set1_ps(DEPOSIT_SPEED)),
+        _mm256_min_ps(deltaHeight, sediment), rising);
+    __m256 amountToErode = _mm256_min_ps(
+        _mm256_mul_ps(_mm256_sub_ps(sedimentCapacity, sediment),
+                      _mm256_set1_ps(ERODE_SPEED)),
+        _mm256_sub_ps(zero, deltaHeight));
+    __m256 amount = _mm256_blendv_ps(amountToErode, amountToDeposit, deposit);
+
+    float lanePosX[DROPLET_LANES], lanePosY[DROPLET_LANES];
+    float laneAmount[DROPLET_LANES], laneSediment[DROPLET_LANES];
+    _mm256_storeu_ps(lanePosX, oldX);
+    _mm256_storeu_ps(lanePosY, oldY);
+    _mm256_storeu_ps(laneAmount, amount);
+    _mm256_storeu_ps(laneSediment, sediment);
+    int aliveBits = _mm256_movemask_ps(alive);
+    int depositBits = _mm256_movemask_ps(deposit);
+    for (int l = 0; l < DROPLET_LANES; ++l) {
+      if (!(aliveBits & (1 << l)))
+        continue;
+      int nodeX = (int)lanePosX[l];
+      int nodeY = (int)lanePosY[l];
+      laneSediment[l] = depositOrErode(
+          erosion, map, nodeX, nodeY, lanePosX[l] - nodeX, lanePosY[l] - nodeY,
+          depositBits & (1 << l), laneAmount[l], laneSediment[l]);
+    }
+    sediment = _mm256_loadu_ps(laneSediment);
+
+    speed = _mm256_sqrt_ps(
+        _mm256_add_ps(_mm256_mul_ps(speed, speed),
+                      _mm256_mul_ps(deltaHeight, _mm256_set1_ps(GRAVITY))));
+    water = _mm256_mul_ps(water, _mm256_set1_ps(1 - EVAPORATE_SPEED));
+  }
+}
+
+#endif
+
+// Runs up to DROPLET_LANES droplets, in lockstep when the CPU has AVX2 and
+// one after another otherwise.
+static void simulateDroplets(const Erosion *erosion, float *map,
+                             const float *posX, const float *posY,
+                             int count) {
+#ifdef DROPLET_SIMD
+  if (haveAVX2()) {
+    simulateDropletsAVX2(erosion, map, posX, posY, count);
+    return;
+  }
+#endif
+  for (int l = 0; l < count; ++l) {
+    simulateDroplet(erosion, map, posX[l], posY[l]);
+  }
+}
+
+// Droplets spawn uniformly over the map, except that ocean cells are half as
+// likely as land. Instead of redrawing rejected ocean spawns, every erode call
+// (or held pass) lists the land cells and then the ocean cells once, and each
+// draw picks from the two lists with land weighted double. Only cells with a
+// right and lower neighbour are listed, since droplets interpolate towards
+// those.
+typedef struct {
+  const int *cells; // land cells, then ocean cells
+  size_t nLand;
+  size_t nOcean;
+  int width, height;
+} SpawnTable;
+
+static SpawnTable buildSpawnTable(Erosion *erosion, const float *map,
+                                  float sealevel) {
+  const int width = erosion->width, height = erosion->height;
+  const size_t spawnable = (size_t)(width - 1) * (height - 1);
+  int *cells = erosion->spawnCells;
+  SpawnTable table = {cells, 0, 0, width, height};
+  if (erosion->holdSpawns && erosion->spawnsHeld) {
+    table.nLand = erosion->heldLand;
+    table.nOcean = erosion->heldOcean;
+    return table;
+  }
+  for (int y = 0; y < height - 1; ++y) {
+    for (int x = 0; x < width - 1; ++x) {
+      int i = y * width + x;
+      if (map[i] < sealevel) {
+        cells[spawnable - 1 - table.nOcean++] = i;
+      } else {
+        cells[table.nLand++] = i;
       }
-      posX += dirX;
-      posY += dirY;
+    }
+  }
+  erosion->spawnsHeld = erosion->holdSpawns;
+  erosion->heldLand = table.nLand;
+  erosion->heldOcean = table.nOcean;
+  return table;
+}
+
+// Maps a uniform draw in [0, 1) to a cell, and the two in-cell offsets, also
+// in [0, 1), to a position inside it.
+static void spawnPosition(const SpawnTable *table, double draw, float offsetX,
+                          float offsetY, float *posX, float *posY) {
+  double weight = draw * (table->nLand + 0.5 * table->nOcean);
+  size_t slot = weight < table->nLand
+                    ? (size_t)weight
+                    : table->nLand + (size_t)((weight - table->nLand) * 2);
+  int cell = table->cells[MIN(slot, table->nLand + table->nOcean - 1)];
+  *posX = MIN(cell % table->width + offsetX, table->width - 1.001f);
+  *posY = MIN(cell / table->width + offsetY, table->height - 1.001f);
+}
+
+static double randUnit() { return rand() / ((double)RAND_MAX + 1); }
+
+static void randomSpawn(const SpawnTable *table, float *posX, float *posY) {
+  double draw = randUnit();
+  float offsetX = randUnit();
+  float offsetY = randUnit();
+  spawnPosition(table, draw, offsetX, offsetY, posX, posY);
+}
 
-      if ((dirX == 0 && dirY == 0) || posX < 0 || posX >= WINDOW_WIDTH - 1 ||
-          posY < 0 || posY >= WINDOW_HEIGHT - 1) {
-        break;
+// Spawns are drawn SPAWN_BATCH at a time. With sortSpawns set, each batch is
+// simulated in Z-order (Morton order) of the spawn cells, so droplets that run
+// one after another start close together and reuse the cache lines and pages
+// the previous ones pulled in. The batch as a whole is the same random sample.
+#define SPAWN_BATCH 16384
+
+typedef struct {
+  uint32_t key;
+  int index; // draw order, which settles ties between equal keys
+  float x, y;
+} BatchSpawn;
+
+// Interleaves the bits of x and y, so nearby cells get nearby keys.
+static uint32_t mortonKey(uint32_t x, uint32_t y) {
+  x = (x | (x << 8)) & 0x00FF00FF;
+  x = (x | (x << 4)) & 0x0F0F0F0F;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  y = (y | (y << 8)) & 0x00FF00FF;
+  y = (y | (y << 4)) & 0x0F0F0F0F;
+  y = (y | (y << 2)) & 0x33333333;
+  y = (y | (y << 1)) & 0x55555555;
+  return x | (y << 1);
+}
+
+// qsort is not stable, so spawns in the same cell keep their draw order
+// through the index rather than through whatever the libc does.
+static int compareSpawns(const void *a, const void *b) {
+  const BatchSpawn *spawnA = (const BatchSpawn *)a;
+  const BatchSpawn *spawnB = (const BatchSpawn *)b;
+  if (spawnA->key != spawnB->key)
+    return spawnA->key > spawnB->key ? 1 : -1;
+  return (spawnA->index > spawnB->index) - (spawnA->index < spawnB->index);
+}
+
+static void drawSpawnBatch(const Erosion *erosion, const SpawnTable *table,
+                           BatchSpawn *batch, int count) {
+  for (int d = 0; d < count; ++d) {
+    randomSpawn(table, &batch[d].x, &batch[d].y);
+    batch[d].key = mortonKey((uint32_t)batch[d].x, (uint32_t)batch[d].y);
+    batch[d].index = d;
+  }
+  if (erosion->sortSpawns) {
+    qsort(batch, count, sizeof(BatchSpawn), compareSpawns);
+  }
+}
+
+void erode(Erosion *erosion, Heightmap *map, int numIterations,
+           float sealevel) {
+  BatchSpawn *batch = (BatchSpawn *)malloc(SPAWN_BATCH * sizeof(BatchSpawn));
+  if (batch == NULL) {
+    fprintf(stderr, "Memory allocation failed for droplet spawns.\n");
+    return;
+  }
+  SpawnTable table = buildSpawnTable(erosion, map->data, sealevel);
+  for (int start = 0; start < numIterations; start += SPAWN_BATCH) {
+    int count = MIN(SPAWN_BATCH, numIterations - start);
+    drawSpawnBatch(erosion, &table, batch, count);
+    for (int d = 0; d < count; ++d) {
+      simulateDroplet(erosion, map->data, batch[d].x, batch[d].y);
+    }
+  }
+  free(batch);
+}
+
+// Same spawning as erode(), but droplets are simulated DROPLET_LANES at a time
+// in lockstep.
+void erode_batch(Erosion *erosion, Heightmap *map, int numIterations,
+                 float sealevel) {
+  BatchSpawn *batch = (BatchSpawn *)malloc(SPAWN_BATCH * sizeof(BatchSpawn));
+  if (batch == NULL) {
+    fprintf(stderr, "Memory allocation failed for droplet spawns.\n");
+    return;
+  }
+  SpawnTable table = buildSpawnTable(erosion, map->data, sealevel);
+  for (int start = 0; start < numIterations; start += SPAWN_BATCH) {
+    int count = MIN(SPAWN_BATCH, numIterations - start);
+    drawSpawnBatch(erosion, &table, batch, count);
+    for (int d = 0; d < count; d += DROPLET_LANES) {
+      float posX[DROPLET_LANES], posY[DROPLET_LANES];
+      int lanes = MIN(DROPLET_LANES, count - d);
+      for (int l = 0; l < lanes; ++l) {
+        posX[l] = batch[d + l].x;
+        posY[l] = batch[d + l].y;
       }
-      float newHeight = calculateHeightAndGradient(map, posX, posY).height;
-      float deltaHeight = newHeight - heightAndGradient.height;
-
-      float sedimentCapcity =
-          MAX(-deltaHeight * speed * water * SEDIMENT_CAPACITY_FACTOR,
-              MIN_SEDIMENT_CAPACITY);
-
-      if (sediment > sedimentCapcity || deltaHeight > 0) {
-        float amountToDeposit =
-            (deltaHeight > 0) ? MIN(deltaHeight, sediment)
-                              : (sediment - sedimentCapcity) * DEPOSIT_SPEED;
-        sediment -= amountToDeposit;
-        (map)[dropletIndex] +=
-            amountToDeposit * (1 - cellOffsetX) * (1 - cellOffsetY);
-        (map)[dropletIndex + 1] +=
-            amountToDeposit * cellOffsetX * (1 - cellOffsetY);
-        (map)[dropletIndex + WINDOW_WIDTH] +=
-            amountToDeposit * (1 - cellOffsetX) * cellOffsetY;
-        (map)[dropletIndex + WINDOW_WIDTH + 1] +=
-            amountToDeposit * cellOffsetX * cellOffsetY;
+      simulateDroplets(erosion, map->data, posX, posY, lanes);
+    }
+  }
+  free(batch);
+}
+
+// Parallel erosion. Droplets are bucketed by the tile they spawn in, and the
+// tiles are run in four checkerboard phases. Two tiles of the same phase are
+// a whole tile apart, and a tile is twice dropletReach() wide, so droplets
+// running at the same time can never touch the same cells.
+static int dropletReach(const Erosion *erosion) {
+  return erosion->lifetime + erosion->radius + 2;
+}
+
+struct Spawn {
+  float x, y;
+  int tile;
+};
+
+typedef struct {
+  const Erosion *erosion;
+  float *map;
+  const SpawnTable *table;
+  uint64_t seed;
+  int tileSize, tileCols;
+  Spawn *spawns;
+  const int *tileStart;
+  const int *phaseTiles;
+  int first; // droplet index of the first spawn drawn
+  // Tiles to run, droplets of the first already run, and where the last
+  // stops, counted from the start of each.
+  int nTiles, skip, stop;
+} ErosionJob;
+
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static float randomUnit(uint64_t *state) {
+  return (splitmix64(state) >> 40) * (1.0f / (1 << 24));
+}
+
+// Each droplet draws its spawn from its own generator seeded by its index, so
+// spawns do not depend on how droplets are split between threads.
+static void spawnTask(void *arg, size_t begin, size_t end) {
+  ErosionJob *job = (ErosionJob *)arg;
+  for (size_t d = job->first + begin; d < job->first + end; ++d) {
+    uint64_t state = job->seed ^ (d * 0xD1B54A32D192ED03ULL);
+    double draw = (splitmix64(&state) >> 11) * (1.0 / (1ULL << 53));
+    float offsetX = randomUnit(&state);
+    float offsetY = randomUnit(&state);
+    float posX, posY;
+    spawnPosition(job->table, draw, offsetX, offsetY, &posX, &posY);
+    job->spawns[d].x = posX;
+    job->spawns[d].y = posY;
+    job->spawns[d].tile = ((int)posY / job->tileSize) * job->tileCols +
+                          (int)posX / job->tileSize;
+  }
+}
+
+static void tileTask(void *arg, size_t begin, size_t end) {
+  ErosionJob *job = (ErosionJob *)arg;
+  for (size_t t = begin; t < end; ++t) {
+    int tile = job->phaseTiles[t];
+    int from = job->tileStart[tile] + (t == 0 ? job->skip : 0);
+    int to = t + 1 == (size_t)job->nTiles ? job->tileStart[tile] + job->stop
+                                          : job->tileStart[tile + 1];
+    for (int d = from; d < to; d += DROPLET_LANES) {
+      float posX[DROPLET_LANES], posY[DROPLET_LANES];
+      int count = MIN(DROPLET_LANES, to - d);
+      for (int l = 0; l < count; ++l) {
+        posX[l] = job->spawns[d + l].x;
+        posY[l] = job->spawns[d + l].y;
+      }
+      if (DROPLET_BATCH) {
+        simulateDroplets(job->erosion, job->map, posX, posY, count);
       } else {
-        float amountToErode =
-            MIN((sedimentCapcity - sediment) * ERODE_SPEED, -deltaHeight);
-        for (size_t brushPointIndex = 0;
-             brushPointIndex < erosion->lengths[dropletIndex];
-             ++brushPointIndex) {
-          int nodeIndex =
-              erosion->erosionBrushIndicies[dropletIndex][brushPointIndex];
-          float weightErodeAmount =
-              amountToErode *
-              erosion->erosionBrushWeights[dropletIndex][brushPointIndex];
-          float deltaSediment = ((map)[nodeIndex] < weightErodeAmount)
-                                    ? (map)[nodeIndex]
-                                    : weightErodeAmount;
-          (map)[nodeIndex] -= deltaSediment;
-          sediment += deltaSediment;
+        for (int l = 0; l < count; ++l) {
+          simulateDroplet(job->erosion, job->map, posX[l], posY[l]);
         }
       }
+    }
+  }
+}
+
+static void listPhaseTiles(ErosionPass *pass) {
+  pass->nPhaseTiles = 0;
+  pass->nextTile = 0;
+  pass->tileDone = 0;
+  for (int ty = pass->phase / 2; ty < pass->tileRows; ty += 2) {
+    for (int tx = pass->phase % 2; tx < pass->tileCols; tx += 2) {
+      pass->phaseTiles[pass->nPhaseTiles++] = ty * pass->tileCols + tx;
+    }
+  }
+}
+
+static bool startPass(ErosionPass *pass, Erosion *erosion, int numIterations,
+                      uint64_t seed, bool tiled) {
+  pass->numIterations = numIterations;
+  pass->ran = 0;
+  pass->done = numIterations <= 0;
+  pass->tiled = tiled;
+  pass->planned = tiled ? 0 : numIterations;
+  pass->seed = seed;
+  pass->spawns = NULL;
+  pass->tileStart = NULL;
+  pass->phaseTiles = NULL;
+  erosion->holdSpawns = true;
+  erosion->spawnsHeld = false;
+  if (!tiled)
+    return true;
+
+  pass->tileSize = 2 * dropletReach(erosion);
+  pass->tileCols = (erosion->width + pass->tileSize - 1) / pass->tileSize;
+  pass->tileRows = (erosion->height + pass->tileSize - 1) / pass->tileSize;
+  const int nTiles = pass->tileCols * pass->tileRows;
+  pass->spawns = (Spawn *)calloc(numIterations, sizeof(Spawn));
+  pass->tileStart = (int *)calloc(nTiles + 1, sizeof(int));
+  pass->phaseTiles = (int *)calloc(nTiles, sizeof(int));
+  if (pass->spawns == NULL || pass->tileStart == NULL ||
+      pass->phaseTiles == NULL) {
+    fprintf(stderr, "Memory allocation failed for erosion schedule.\n");
+    free_erode_pass(pass, erosion);
+    return false;
+  }
+  return true;
+}
+
+bool erode_pass_init(ErosionPass *pass, Erosion *erosion, int numIterations,
+                     uint64_t seed) {
+  return startPass(pass, erosion, numIterations, seed, PARALLEL_EROSION);
+}
+
+// Counting sort by tile, keeping droplet order within each tile.
+static bool sortSpawns(ErosionPass *pass) {
+  const int nTiles = pass->tileCols * pass->tileRows;
+  const Spawn *spawns = pass->spawns;
+  int *tileStart = pass->tileStart;
+  Spawn *sorted = (Spawn *)calloc(pass->numIterations, sizeof(Spawn));
+  int *fill = (int *)calloc(nTiles, sizeof(int));
+  if (sorted == NULL || fill == NULL) {
+    fprintf(stderr, "Memory allocation failed for erosion schedule.\n");
+    free(sorted);
+    free(fill);
+    return false;
+  }
+  for (int d = 0; d < pass->numIterations; ++d) {
+    tileStart[spawns[d].tile + 1]++;
+  }
+  for (int t = 0; t < nTiles; ++t) {
+    tileStart[t + 1] += tileStart[t];
+  }
+  for (int d = 0; d < pass->numIterations; ++d) {
+    sorted[tileStart[spawns[d].tile] + fill[spawns[d].tile]++] = spawns[d];
+  }
+  free(pass->spawns);
+  free(fill);
+  pass->spawns = sorted;
+  return true;
+}
+
+// Every spawn is drawn from its own generator, seeded by the droplet index,
+// so drawing them in pieces gives the same schedule as all at once.
+int erodePassSpawn(ErosionPass *pass, Erosion *erosion, const Heightmap *map,
+                   int droplets, float sealevel, size_t nThreads) {
+  const int count = MIN(droplets, pass->numIterations - pass->planned);
+  if (count <= 0)
+    return 0;
+  SpawnTable table = buildSpawnTable(erosion, map->data, sealevel);
+  ErosionJob job = {.erosion = erosion,
+                    .map = map->data,
+                    .table = &table,
+                    .seed = pass->seed,
+                    .tileSize = pass->tileSize,
+                    .tileCols = pass->tileCols,
+                    .spawns = pass->spawns,
+                    .first = pass->planned};
+  parallelFor(count, nThreads, spawnTask, &job);
+  pass->planned += count;
+  if (pass->planned < pass->numIterations)
+    return count;
+
+  if (!sortSpawns(pass)) {
+    pass->done = true;
+    return count;
+  }
+  pass->phase = 0;
+  listPhaseTiles(pass);
+  return count;
+}
+
+void free_erode_pass(ErosionPass *pass, Erosion *erosion) {
+  free(pass->spawns);
+  free(pass->tileStart);
+  free(pass->phaseTiles);
+  pass->spawns = NULL;
+  pass->tileStart = NULL;
+  pass->phaseTiles = NULL;
+  erosion->holdSpawns = false;
+}
+
+int erodePassRun(ErosionPass *pass, Erosion *erosion, Heightmap *map,
+                 int droplets, float sealevel, size_t nThreads) {
+  int ran = 0;
+  if (pass->done) {
+    return 0;
+  } else if (pass->tiled) {
+    ErosionJob job = {.erosion = erosion,
+                      .map = map->data,
+                      .tileSize = pass->tileSize,
+                      .tileCols = pass->tileCols,
+                      .spawns = pass->spawns,
+                      .tileStart = pass->tileStart};
+    // A tile can stop part way, between lockstep groups, and go on from
+    // there next time; its droplets still run in the same order.
+    while (ran < droplets && pass->phase < 4) {
+      const int first = pass->nextTile;
+      int last = first, stop = 0;
+      bool partial = false;
+      while (last < pass->nPhaseTiles && ran < droplets) {
+        int tile = pass->phaseTiles[last];
+        int begin = last++ == first ? pass->tileDone : 0;
+        int size = pass->tileStart[tile + 1] - pass->tileStart[tile];
+        int groups = (droplets - ran + DROPLET_LANES - 1) / DROPLET_LANES;
+        stop = MIN(size, begin + groups * DROPLET_LANES);
+        ran += stop - begin;
+        partial = stop < size;
+      }
+      job.phaseTiles = pass->phaseTiles + first;
+      job.nTiles = last - first;
+      job.skip = pass->tileDone;
+      job.stop = stop;
+      parallelFor(last - first, nThreads, tileTask, &job);
+      pass->nextTile = partial ? last - 1 : last;
+      pass->tileDone = partial ? stop : 0;
+      if (pass->nextTile == pass->nPhaseTiles && ++pass->phase < 4)
+        listPhaseTiles(pass);
+    }
+  } else {
+    int batches = (droplets + SPAWN_BATCH - 1) / SPAWN_BATCH;
+    ran = MIN(pass->numIterations - pass->ran, batches * SPAWN_BATCH);
+    if (DROPLET_BATCH)
+      erode_batch(erosion, map, ran, sealevel);
+    else
+      erode(erosion, map, ran, sealevel);
+  }
+  pass->ran += ran;
+  pass->done = pass->ran >= pass->numIterations;
+  return ran;
+}
+
+void erode_parallel(Erosion *erosion, Heightmap *map, int numIterations,
+                    float sealevel, size_t nThreads, uint64_t seed) {
+  ErosionPass pass;
+  if (!startPass(&pass, erosion, numIterations, seed, true))
+    return;
+  erodePassSpawn(&pass, erosion, map, numIterations, sealevel, nThreads);
+  erodePassRun(&pass, erosion, map, numIterations, sealevel, nThreads);
+  free_erode_pass(&pass, erosion);
+}
+
+// Multi-resolution erosion. The map is averaged down into a pyramid of
+// half-size levels. Most of the droplet budget is spent on the coarse levels,
+// where a droplet is cheap and carves drainage across many full-resolution
+// cells; the remaining PYRAMID_FINE_SHARE refines at full resolution. Brush
+// radius and lifetime shrink with the level so a droplet covers about the same
+// ground everywhere. What a level changed is upsampled onto the next finer
+// level, so fine detail is kept and only the erosion is carried up.
+typedef struct {
+  int width, height;
+  float *map;      // eroded in place
+  float *original; // the level as first downsampled
+} PyramidLevel;
+
+static void downsample(const float *fine, int fineWidth, float *coarse,
+                       int width, int height) {
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const float *p = fine + 2 * y * fineWidth + 2 * x;
+      coarse[y * width + x] =
+          (p[0] + p[1] + p[fineWidth] + p[fineWidth + 1]) * 0.25f;
+    }
+  }
+}
+
+// Adds the bilinearly upsampled change of the coarse level to the fine map.
+static void addUpsampledChange(const PyramidLevel *coarse, float *fine,
+                               int fineWidth, int fineHeight) {
+  for (int y = 0; y < fineHeight; ++y) {
+    float cy = MIN(MAX((y + 0.5f) * 0.5f - 0.5f, 0), coarse->height - 1.001f);
+    int y0 = (int)cy;
+    float v = cy - y0;
+    for (int x = 0; x < fineWidth; ++x) {
+      float cx = MIN(MAX((x + 0.5f) * 0.5f - 0.5f, 0), coarse->width - 1.001f);
+      int x0 = (int)cx;
+      float u = cx - x0;
+      int i = y0 * coarse->width + x0;
+      int w = coarse->width;
+      float d00 = coarse->map[i] - coarse->original[i];
+      float d10 = coarse->map[i + 1] - coarse->original[i + 1];
+      float d01 = coarse->map[i + w] - coarse->original[i + w];
+      float d11 = coarse->map[i + w + 1] - coarse->original[i + w + 1];
+      fine[y * fineWidth + x] +=
+          (d00 * (1 - u) + d10 * u) * (1 - v) + (d01 * (1 - u) + d11 * u) * v;
+    }
+  }
+}
+
+void erode_pyramid(Erosion *erosion, Heightmap *map, int numIterations,
+                   float sealevel, size_t nThreads, uint64_t seed) {
+  PyramidLevel levels[PYRAMID_LEVELS];
+  int nLevels = 1;
+  int width = erosion->width, height = erosion->height;
+  // Stop before a level gets too small to hold a droplet's reach.
+  while (nLevels < PYRAMID_LEVELS && width / 2 >= 64 && height / 2 >= 64) {
+    int coarseWidth = width / 2, coarseHeight = height / 2;
+    PyramidLevel *level = &levels[nLevels];
+    level->width = coarseWidth;
+    level->height = coarseHeight;
+    level->map = (float *)malloc(2 * (size_t)coarseWidth * coarseHeight *
+                                 sizeof(float));
+    if (level->map == NULL) {
+      fprintf(stderr, "Memory allocation failed for erosion pyramid.\n");
+      break;
+    }
+    level->original = level->map + (size_t)coarseWidth * coarseHeight;
+    const float *fine =
+        nLevels == 1 ? map->data : levels[nLevels - 1].original;
+    downsample(fine, width, level->original, coarseWidth, coarseHeight);
+    memcpy(level->map, level->original,
+           (size_t)coarseWidth * coarseHeight * sizeof(float));
+    width = coarseWidth;
+    height = coarseHeight;
+    nLevels++;
+  }
+
+  int fineDroplets = (int)(numIterations * PYRAMID_FINE_SHARE);
+  if (nLevels == 1)
+    fineDroplets = numIterations;
+  int coarseDroplets =
+      nLevels > 1 ? (numIterations - fineDroplets) / (nLevels - 1) : 0;
+
+  for (int l = nLevels - 1; l >= 1; --l) {
+    PyramidLevel *level = &levels[l];
+    Erosion coarse;
+    int radius = MAX(2, (erosion->radius + (1 << l) - 1) >> l);
+    int lifetime = MAX(8, erosion->lifetime >> l);
+    erodeInitLevel(&coarse, level->width, level->height, radius, lifetime);
+    Heightmap view = {level->width, level->height, level->width, level->map};
+    erode_parallel(&coarse, &view, coarseDroplets, sealevel, nThreads,
+                   seed ^ (l * 0x9E3779B97F4A7C15ULL));
+    free_erode(&coarse);
+
+    bool finest = l == 1;
+    addUpsampledChange(level, finest ? map->data : levels[l - 1].map,
+                       finest ? erosion->width : levels[l - 1].width,
+                       finest ? erosion->height : levels[l - 1].height);
+    free(level->map);
+  }
+  erode_parallel(erosion, map, fineDroplets, sealevel, nThreads, seed);
+}
+
+// Grid erosion with the virtual-pipe shallow-water model. Water height,
+// outflow flux, velocity and suspended sediment are kept per cell and every
+// pass updates each cell from its neighbours' previous values, so rows can be
+// split between threads freely. Cells below sealevel drain: they drop their
+// sediment and lose their water. The scalar passes handle the border rows and
+// columns, where neighbours are missing; the interior runs eight cells at a
+// time where AVX2 is available, with the same expressions in the same order,
+// so both paths give the same map.
+enum { PIPE_FLUX, PIPE_WATER, PIPE_ERODE, PIPE_TRANSPORT };
+
+typedef struct {
+  float *map, *nextMap;
+  float *water;
+  float *sediment, *nextSediment;
+  float *fluxL, *fluxR, *fluxT, *fluxB;
+  float *velX, *velY;
+  float sealevel;
+  int pass;
+  int width, height;
+} PipeJob;
+
+// Outflow to each neighbour grows with the height difference, and is scaled
+// back so a cell never sends away more water than it holds.
+static void pipeFlux(PipeJob *job, int y, int x0, int x1) {
+  const int width = job->width;
+  const float *map = job->map, *water = job->water;
+  for (int x = x0; x < x1; ++x) {
+    int i = y * width + x;
+    float height = map[i] + water[i];
+    float l = 0, r = 0, t = 0, b = 0;
+    if (x > 0)
+      l = MAX(0, job->fluxL[i] + PIPE_TIME_STEP * PIPE_GRAVITY *
+                                     (height - map[i - 1] - water[i - 1]));
+    if (x < width - 1)
+      r = MAX(0, job->fluxR[i] + PIPE_TIME_STEP * PIPE_GRAVITY *
+                                     (height - map[i + 1] - water[i + 1]));
+    if (y > 0)
+      t = MAX(0, job->fluxT[i] + PIPE_TIME_STEP * PIPE_GRAVITY *
+                                     (height - map[i - width] -
+                                      water[i - width]));
+    if (y < job->height - 1)
+      b = MAX(0, job->fluxB[i] + PIPE_TIME_STEP * PIPE_GRAVITY *
+                                     (height - map[i + width] -
+                                      water[i + width]));
+    float outflow = (l + r + t + b) * PIPE_TIME_STEP;
+    float scale = outflow > water[i] ? water[i] / outflow : 1;
+    job->fluxL[i] = l * scale;
+    job->fluxR[i] = r * scale;
+    job->fluxT[i] = t * scale;
+    job->fluxB[i] = b * scale;
+  }
+}
+
+// Moves water along the fluxes and derives the velocity field from the net
+// flow through each cell.
+static void pipeWater(PipeJob *job, int y, int x0, int x1) {
+  const int width = job->width, height = job->height;
+  for (int x = x0; x < x1; ++x) {
+    int i = y * width + x;
+    float inL = x > 0 ? job->fluxR[i - 1] : 0;
+    float inR = x < width - 1 ? job->fluxL[i + 1] : 0;
+    float inT = y > 0 ? job->fluxB[i - width] : 0;
+    float inB = y < height - 1 ? job->fluxT[i + width] : 0;
+    float outflow =
+        job->fluxL[i] + job->fluxR[i] + job->fluxT[i] + job->fluxB[i];
+    float oldWater = job->water[i];
+    float newWater =
+        MAX(0, oldWater + PIPE_TIME_STEP * (inL + inR + inT + inB - outflow));
+    float meanWater = (oldWater + newWater) * 0.5f;
+    float flowX = (inL - job->fluxL[i] + job->fluxR[i] - inR) * 0.5f;
+    float flowY = (inT - job->fluxT[i] + job->fluxB[i] - inB) * 0.5f;
+    // Sediment may move at most one cell per step.
+    float velX = meanWater > 1e-6f ? flowX / meanWater : 0;
+    float velY = meanWater > 1e-6f ? flowY / meanWater : 0;
+    job->velX[i] = MIN(MAX(velX, -1 / PIPE_TIME_STEP), 1 / PIPE_TIME_STEP);
+    job->velY[i] = MIN(MAX(velY, -1 / PIPE_TIME_STEP), 1 / PIPE_TIME_STEP);
+    job->water[i] = newWater;
+  }
+}
 
-      speed = sqrt(speed * speed + deltaHeight * GRAVITY);
-      water *= (1 - EVAPORATE_SPEED);
+// Dissolves terrain where the flow can carry more sediment than it holds and
+// deposits it where it carries too much. Writes to nextMap, since the slope
+// is read from the neighbours.
+static void pipeErode(PipeJob *job, int y, int x0, int x1) {
+  const int width = job->width;
+  const float *map = job->map;
+  for (int x = x0; x < x1; ++x) {
+    int i = y * width + x;
+    float height = map[i];
+    float sediment = job->sediment[i];
+    if (height < job->sealevel) {
+      job->nextMap[i] = height + sediment;
+      job->sediment[i] = 0;
+      job->water[i] = 0;
+      continue;
     }
+    float slopeX =
+        (map[x < width - 1 ? i + 1 : i] - map[x > 0 ? i - 1 : i]) * 0.5f;
+    float slopeY = (map[y < job->height - 1 ? i + width : i] -
+                    map[y > 0 ? i - width : i]) *
+                   0.5f;
+    float slope2 = slopeX * slopeX + slopeY * slopeY;
+    float sinTilt = MAX(sqrtf(slope2 / (1 + slope2)), PIPE_MIN_TILT);
+    float speed = sqrtf(job->velX[i] * job->velX[i] +
+                        job->velY[i] * job->velY[i]);
+    float capacity = PIPE_CAPACITY * sinTilt * speed;
+    float amount = capacity > sediment
+                       ? MIN(PIPE_DISSOLVE * (capacity - sediment), height)
+                       : -PIPE_DEPOSIT * (sediment - capacity);
+    job->nextMap[i] = height - amount;
+    job->sediment[i] = sediment + amount;
+  }
+}
+
+// Carries sediment backwards along the velocity field, then evaporates and
+// rains onto land for the next step.
+static void pipeTransport(PipeJob *job, int y, int x0, int x1) {
+  const int width = job->width, height = job->height;
+  const float *sediment = job->sediment;
+  for (int x = x0; x < x1; ++x) {
+    int i = y * width + x;
+    float fromX = x - job->velX[i] * PIPE_TIME_STEP;
+    float fromY = y - job->velY[i] * PIPE_TIME_STEP;
+    fromX = MIN(MAX(fromX, 0), width - 1.001f);
+    fromY = MIN(MAX(fromY, 0), height - 1.001f);
+    int cellX = (int)fromX, cellY = (int)fromY;
+    float u = fromX - cellX, v = fromY - cellY;
+    int j = cellY * width + cellX;
+    job->nextSediment[i] =
+        (sediment[j] * (1 - u) + sediment[j + 1] * u) * (1 - v) +
+        (sediment[j + width] * (1 - u) + sediment[j + width + 1] * u) * v;
+    float rain = job->map[i] < job->sealevel ? 0 : PIPE_RAIN;
+    job->water[i] = job->water[i] * (1 - PIPE_EVAPORATE) + rain;
+  }
+}
+
+#ifdef DROPLET_SIMD
+// Eight cells of row y at a time, for columns in [x0, x1) that have all four
+// neighbours. Each returns the first column left for the scalar pass.
+__attribute__((target("avx2"))) static __m256 pipeOutflow8(__m256 flux,
+                                                           __m256 height,
+                                                           const float *map,
+                                                           const float *water) {
+  const __m256 pressure = _mm256_set1_ps(PIPE_TIME_STEP * PIPE_GRAVITY);
+  __m256 drop = _mm256_sub_ps(_mm256_sub_ps(height, _mm256_loadu_ps(map)),
+                              _mm256_loadu_ps(water));
+  return _mm256_max_ps(_mm256_setzero_ps(),
+                       _mm256_add_ps(flux, _mm256_mul_ps(pressure, drop)));
+}
+
+__attribute__((target("avx2"))) static int pipeFluxAVX2(PipeJob *job, int y,
+                                                        int x0, int x1) {
+  const int width = job->width;
+  const float *map = job->map, *water = job->water;
+  const __m256 step = _mm256_set1_ps(PIPE_TIME_STEP);
+  const __m256 one = _mm256_set1_ps(1);
+  int x = x0;
+  for (; x + 8 <= x1; x += 8) {
+    int i = y * width + x;
+    __m256 held = _mm256_loadu_ps(water + i);
+    __m256 height = _mm256_add_ps(_mm256_loadu_ps(map + i), held);
+    __m256 l = pipeOutflow8(_mm256_loadu_ps(job->fluxL + i), height,
+                            map + i - 1, water + i - 1);
+    __m256 r = pipeOutflow8(_mm256_loadu_ps(job->fluxR + i), height,
+                            map + i + 1, water + i + 1);
+    __m256 t = pipeOutflow8(_mm256_loadu_ps(job->fluxT + i), height,
+                            map + i - width, water + i - width);
+    __m256 b = pipeOutflow8(_mm256_loadu_ps(job->fluxB + i), height,
+                            map + i + width, water + i + width);
+    __m256 outflow = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(l, r), t), b), step);
+    __m256 scale = _mm256_blendv_ps(
+        one, _mm256_div_ps(held, outflow),
+        _mm256_cmp_ps(outflow, held, _CMP_GT_OQ));
+    _mm256_storeu_ps(job->fluxL + i, _mm256_mul_ps(l, scale));
+    _mm256_storeu_ps(job->fluxR + i, _mm256_mul_ps(r, scale));
+    _mm256_storeu_ps(job->fluxT + i, _mm256_mul_ps(t, scale));
+    _mm256_storeu_ps(job->fluxB + i, _mm256_mul_ps(b, scale));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) static int pipeWaterAVX2(PipeJob *job, int y,
+                                                         int x0, int x1) {
+  const int width = job->width;
+  const __m256 step = _mm256_set1_ps(PIPE_TIME_STEP);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 damp = _mm256_set1_ps(1e-6f);
+  const __m256 lowest = _mm256_set1_ps(-1 / PIPE_TIME_STEP);
+  const __m256 highest = _mm256_set1_ps(1 / PIPE_TIME_STEP);
+  const __m256 zero = _mm256_setzero_ps();
+  int x = x0;
+  for (; x + 8 <= x1; x += 8) {
+    int i = y * width + x;
+    __m256 inL = _mm256_loadu_ps(job->fluxR + i - 1);
+    __m256 inR = _mm256_loadu_ps(job->fluxL + i + 1);
+    __m256 inT = _mm256_loadu_ps(job->fluxB + i - width);
+    __m256 inB = _mm256_loadu_ps(job->fluxT + i + width);
+    __m256 fluxL = _mm256_loadu_ps(job->fluxL + i);
+    __m256 fluxR = _mm256_loadu_ps(job->fluxR + i);
+    __m256 fluxT = _mm256_loadu_ps(job->fluxT + i);
+    __m256 fluxB = _mm256_loadu_ps(job->fluxB + i);
+    __m256 outflow = _mm256_add_ps(
+        _mm256_add_ps(_mm256_add_ps(fluxL, fluxR), fluxT), fluxB);
+    __m256 inflow =
+        _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(inL, inR), inT), inB);
+    __m256 oldWater = _mm256_loadu_ps(job->water + i);
+    __m256 newWater = _mm256_max_ps(
+        zero, _mm256_add_ps(oldWater, _mm256_mul_ps(step, _mm256_sub_ps(
+                                                              inflow, outflow))));
+    __m256 meanWater = _mm256_mul_ps(_mm256_add_ps(oldWater, newWater), half);
+    __m256 flowX = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(inL, fluxL), fluxR), inR),
+        half);
+    __m256 flowY = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(inT, fluxT), fluxB), inB),
+        half);
+    __m256 wet = _mm256_cmp_ps(meanWater, damp, _CMP_GT_OQ);
+    __m256 velX = _mm256_and_ps(wet, _mm256_div_ps(flowX, meanWater));
+    __m256 velY = _mm256_and_ps(wet, _mm256_div_ps(flowY, meanWater));
+    _mm256_storeu_ps(job->velX + i,
+                     _mm256_min_ps(_mm256_max_ps(velX, lowest), highest));
+    _mm256_storeu_ps(job->velY + i,
+                     _mm256_min_ps(_mm256_max_ps(velY, lowest), highest));
+    _mm256_storeu_ps(job->water + i, newWater);
   }
+  return x;
+}
+
+__attribute__((target("avx2"))) static int pipeErodeAVX2(PipeJob *job, int y,
+                                                         int x0, int x1) {
+  const int width = job->width;
+  const float *map = job->map;
+  const __m256 sealevel = _mm256_set1_ps(job->sealevel);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 one = _mm256_set1_ps(1);
+  const __m256 minTilt = _mm256_set1_ps(PIPE_MIN_TILT);
+  const __m256 capacityFactor = _mm256_set1_ps(PIPE_CAPACITY);
+  const __m256 dissolve = _mm256_set1_ps(PIPE_DISSOLVE);
+  const __m256 deposit = _mm256_set1_ps(-PIPE_DEPOSIT);
+  int x = x0;
+  for (; x + 8 <= x1; x += 8) {
+    int i = y * width + x;
+    __m256 height = _mm256_loadu_ps(map + i);
+    __m256 sediment = _mm256_loadu_ps(job->sediment + i);
+    __m256 slopeX = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_loadu_ps(map + i + 1), _mm256_loadu_ps(map + i - 1)),
+        half);
+    __m256 slopeY = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(map + i + width),
+                                                _mm256_loadu_ps(map + i - width)),
+                                  half);
+    __m256 slope2 = _mm256_add_ps(_mm256_mul_ps(slopeX, slopeX),
+                                  _mm256_mul_ps(slopeY, slopeY));
+    __m256 sinTilt = _mm256_max_ps(
+        _mm256_sqrt_ps(_mm256_div_ps(slope2, _mm256_add_ps(one, slope2))),
+        minTilt);
+    __m256 velX = _mm256_loadu_ps(job->velX + i);
+    __m256 velY = _mm256_loadu_ps(job->velY + i);
+    __m256 speed = _mm256_sqrt_ps(
+        _mm256_add_ps(_mm256_mul_ps(velX, velX), _mm256_mul_ps(velY, velY)));
+    __m256 capacity =
+        _mm256_mul_ps(_mm256_mul_ps(capacityFactor, sinTilt), speed);
+    __m256 taken = _mm256_min_ps(
+        _mm256_mul_ps(dissolve, _mm256_sub_ps(capacity, sediment)), height);
+    __m256 dropped =
+        _mm256_mul_ps(deposit, _mm256_sub_ps(sediment, capacity));
+    __m256 amount = _mm256_blendv_ps(
+        dropped, taken, _mm256_cmp_ps(capacity, sediment, _CMP_GT_OQ));
+    // Below sealevel the cell drains instead.
+    __m256 sea = _mm256_cmp_ps(height, sealevel, _CMP_LT_OQ);
+    _mm256_storeu_ps(job->nextMap + i,
+                     _mm256_blendv_ps(_mm256_sub_ps(height, amount),
+                                      _mm256_add_ps(height, sediment), sea));
+    _mm256_storeu_ps(job->sediment + i,
+                     _mm256_andnot_ps(sea, _mm256_add_ps(sediment, amount)));
+    _mm256_storeu_ps(job->water + i,
+                     _mm256_andnot_ps(sea, _mm256_loadu_ps(job->water + i)));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) static int
+pipeTransportAVX2(PipeJob *job, int y, int x0, int x1) {
+  const int width = job->width, height = job->height;
+  const float *sediment = job->sediment;
+  const __m256 step = _mm256_set1_ps(PIPE_TIME_STEP);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1);
+  const __m256 lastX = _mm256_set1_ps(width - 1.001f);
+  const __m256 lastY = _mm256_set1_ps(height - 1.001f);
+  const __m256 rowY = _mm256_set1_ps((float)y);
+  const __m256 sealevel = _mm256_set1_ps(job->sealevel);
+  const __m256 rain = _mm256_set1_ps(PIPE_RAIN);
+  const __m256 keep = _mm256_set1_ps(1 - PIPE_EVAPORATE);
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i stride = _mm256_set1_epi32(width);
+  const __m256i next = _mm256_set1_epi32(1);
+  int x = x0;
+  for (; x + 8 <= x1; x += 8) {
+    int i = y * width + x;
+    __m256 column =
+        _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), lanes));
+    __m256 fromX = _mm256_sub_ps(
+        column, _mm256_mul_ps(_mm256_loadu_ps(job->velX + i), step));
+    __m256 fromY = _mm256_sub_ps(
+        rowY, _mm256_mul_ps(_mm256_loadu_ps(job->velY + i), step));
+    fromX = _mm256_min_ps(_mm256_max_ps(fromX, zero), lastX);
+    fromY = _mm256_min_ps(_mm256_max_ps(fromY, zero), lastY);
+    __m256i cellX = _mm256_cvttps_epi32(fromX);
+    __m256i cellY = _mm256_cvttps_epi32(fromY);
+    __m256 u = _mm256_sub_ps(fromX, _mm256_cvtepi32_ps(cellX));
+    __m256 v = _mm256_sub_ps(fromY, _mm256_cvtepi32_ps(cellY));
+    __m256i j = _mm256_add_epi32(_mm256_mullo_epi32(cellY, stride), cellX);
+    __m256i below = _mm256_add_epi32(j, stride);
+    __m256 s00 = _mm256_i32gather_ps(sediment, j, 4);
+    __m256 s10 = _mm256_i32gather_ps(sediment, _mm256_add_epi32(j, next), 4);
+    __m256 s01 = _mm256_i32gather_ps(sediment, below, 4);
+    __m256 s11 =
+        _mm256_i32gather_ps(sediment, _mm256_add_epi32(below, next), 4);
+    __m256 restU = _mm256_sub_ps(one, u), restV = _mm256_sub_ps(one, v);
+    __m256 top = _mm256_add_ps(_mm256_mul_ps(s00, restU), _mm256_mul_ps(s10, u));
+    __m256 bottom =
+        _mm256_add_ps(_mm256_mul_ps(s01, restU), _mm256_mul_ps(s11, u));
+    _mm256_storeu_ps(job->nextSediment + i,
+                     _mm256_add_ps(_mm256_mul_ps(top, restV),
+                                   _mm256_mul_ps(bottom, v)));
+    __m256 sea =
+        _mm256_cmp_ps(_mm256_loadu_ps(job->map + i), sealevel, _CMP_LT_OQ);
+    __m256 water = _mm256_mul_ps(_mm256_loadu_ps(job->water + i), keep);
+    _mm256_storeu_ps(job->water + i,
+                     _mm256_add_ps(water, _mm256_andnot_ps(sea, rain)));
+  }
+  return x;
+}
+
+#endif
+
+typedef void (*PipePass)(PipeJob *job, int y, int x0, int x1);
+typedef int (*PipePassAVX2)(PipeJob *job, int y, int x0, int x1);
+
+static void pipeTask(void *arg, size_t begin, size_t end) {
+  PipeJob *job = (PipeJob *)arg;
+  static const PipePass passes[] = {pipeFlux, pipeWater, pipeErode,
+                                    pipeTransport};
+  const PipePass pass = passes[job->pass];
+#ifdef DROPLET_SIMD
+  static const PipePassAVX2 passesAVX2[] = {pipeFluxAVX2, pipeWaterAVX2,
+                                            pipeErodeAVX2, pipeTransportAVX2};
+  const PipePassAVX2 passAVX2 = haveAVX2() ? passesAVX2[job->pass] : NULL;
+#endif
+  const int width = job->width;
+  for (size_t row = begin; row < end; ++row) {
+    const int y = (int)row;
+    if (y == 0 || y == job->height - 1) {
+      pass(job, y, 0, width);
+      continue;
+    }
+    pass(job, y, 0, 1);
+    int x = 1;
+#ifdef DROPLET_SIMD
+    if (passAVX2 != NULL)
+      x = passAVX2(job, y, x, width - 1);
+#endif
+    pass(job, y, x, width);
+  }
+}
+
+static double seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double erode_grid(Heightmap *heightmap, int numSteps, float sealevel,
+                  size_t nThreads) {
+  const size_t cells = (size_t)heightmap->width * heightmap->height;
+  float *map = heightmap->data;
+  // Ten fields of one float per cell, carved out of one block.
+  float *fields = (float *)calloc(cells * 10, sizeof(float));
+  if (fields == NULL) {
+    fprintf(stderr, "Memory allocation failed for grid erosion.\n");
+    return 0;
+  }
+  PipeJob job = {.map = map,
+                 .nextMap = fields,
+                 .water = fields + cells,
+                 .sediment = fields + 2 * cells,
+                 .nextSediment = fields + 3 * cells,
+                 .fluxL = fields + 4 * cells,
+                 .fluxR = fields + 5 * cells,
+                 .fluxT = fields + 6 * cells,
+                 .fluxB = fields + 7 * cells,
+                 .velX = fields + 8 * cells,
+                 .velY = fields + 9 * cells,
+                 .sealevel = sealevel,
+                 .pass = PIPE_FLUX,
+                 .width = heightmap->width,
+                 .height = heightmap->height};
+  for (size_t i = 0; i < cells; ++i) {
+    job.water[i] = map[i] < sealevel ? 0 : PIPE_RAIN;
+  }
+
+  double start = seconds();
+  for (int step = 0; step < numSteps; ++step) {
+    for (job.pass = PIPE_FLUX; job.pass <= PIPE_TRANSPORT; ++job.pass) {
+      parallelFor(heightmap->height, nThreads, pipeTask, &job);
+      if (job.pass == PIPE_ERODE) {
+        float *swap = job.map;
+        job.map = job.nextMap;
+        job.nextMap = swap;
+      }
+    }
+    float *swap = job.sediment;
+    job.sediment = job.nextSediment;
+    job.nextSediment = swap;
+  }
+  double elapsed = seconds() - start;
+
+  // Whatever is still suspended settles where it is.
+  for (size_t i = 0; i < cells; ++i) {
+    map[i] = job.map[i] + job.sediment[i];
+  }
+  free(fields);
+
+  return elapsed > 0 ? cells * (double)numSteps / elapsed : 0;
 }
@@ -1,12 +1,71 @@
 #pragma once
 #include "common.h"
+#include "config.h"
+#include "heightmap.h"
+#include <stdint.h>
 
+// Erosion brushes, grouped by how the map edges clip them. Entries
+// brushStarts[c] .. brushStarts[c + 1] hold the index offsets (from the centre
+// cell) and normalised weights of brush class c. spawnCells is scratch space
+// for the per-call droplet spawn table. sortSpawns starts out as SORTED_SPAWNS
+// and makes the serial engines run each spawn batch in Morton order. While
+// holdSpawns is set, as it is for a serial ErosionPass, the spawn table the
+// first call builds is reused by the calls after it.
 typedef struct {
-  int **erosionBrushIndicies;
-  float **erosionBrushWeights;
-  size_t *lengths;
+  int width, height; // map size in cells
+  int radius;        // erosion brush radius
+  int lifetime;      // maximum droplet steps
+  int *brushStarts;
+  int *brushOffsets;
+  float *brushWeights;
+  int *spawnCells;
+  bool sortSpawns;
+  bool holdSpawns;
+  bool spawnsHeld;
+  size_t heldLand, heldOcean;
 } Erosion;
 
-void erode_init(Erosion *erosion);
+void erode_init(Erosion *erosion, const Config *config);
 void free_erode(Erosion *erosion);
-void erode(Erosion *erosion, float *map, int numIteration, float sealevel);
+void erode(Erosion *erosion, Heightmap *map, int numIteration, float sealevel);
+void erode_batch(Erosion *erosion, Heightmap *map, int numIterations,
+                 float sealevel);
+void erode_parallel(Erosion *erosion, Heightmap *map, int numIterations,
+                    float sealevel, size_t nThreads, uint64_t seed);
+void erode_pyramid(Erosion *erosion, Heightmap *map, int numIterations,
+                   float sealevel, size_t nThreads, uint64_t seed);
+typedef struct Spawn Spawn;
+
+// One droplet pass with the configured engine, set up and run a part at a
+// time. For erode_parallel, erodePassSpawn draws the spawns and, once they
+// are all drawn, buckets them by tile; erodePassRun then runs whole tiles in
+// phase order. Tiles of a phase never touch, so the map is the same however
+// the pass is split. The serial engines need no spawning and run whole
+// SPAWN_BATCH batches from a held spawn table, which draws the same spawns
+// from rand() as one call would. Both return how many droplets they handled,
+// at least the number asked for unless the pass runs out first.
+typedef struct {
+  int numIterations;
+  int planned; // droplets spawned so far
+  int ran;     // droplets run so far
+  bool done;
+  bool tiled;
+  uint64_t seed;
+  int tileSize, tileCols, tileRows;
+  Spawn *spawns; // sorted by tile once all are drawn
+  int *tileStart;
+  int *phaseTiles;
+  int phase, nPhaseTiles, nextTile;
+  int tileDone; // droplets of the next tile already run
+} ErosionPass;
+
+bool erode_pass_init(ErosionPass *pass, Erosion *erosion, int numIterations,
+                     uint64_t seed);
+void free_erode_pass(ErosionPass *pass, Erosion *erosion);
+int erodePassSpawn(ErosionPass *pass, Erosion *erosion, const Heightmap *map,
+                   int droplets, float sealevel, size_t nThreads);
+int erodePassRun(ErosionPass *pass, Erosion *erosion, Heightmap *map,
+                 int droplets, float sealevel, size_t nThreads);
+// Pipe-model grid erosion. Returns the cells/second it achieved.
+double erode_grid(Heightmap *map, int numSteps, float sealevel,
+                  size_t nThreads);
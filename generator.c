@@ -0,0 +1,547 @@
+#include "generator.h"
+#include "common.h"
+#include "parallel.h"
+#include "thermal.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static double seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Sealevel bisects [0, 1] down to an interval under 0.001 wide, which takes
+// ten halvings, so every level it tries is a multiple of 1 / SEALEVEL_BINS.
+// With cells binned by floor(height * SEALEVEL_BINS), the number of cells
+// below such a level is an exact prefix sum of the histogram, so one pass
+// over the map answers every step of the search. Heights of 1 or more share
+// the last bin, which lies above every level tried.
+#define SEALEVEL_BINS 1024
+
+typedef struct {
+  const Heightmap *map;
+  size_t nBands;
+  int64_t *counts; // SEALEVEL_BINS + 1 per band
+} HistogramJob;
+
+static int sealevelBin(float height) {
+  float scaled = height * SEALEVEL_BINS;
+  if (scaled < 0)
+    return 0;
+  return scaled < SEALEVEL_BINS ? (int)scaled : SEALEVEL_BINS;
+}
+
+static void histogramTask(void *arg, size_t begin, size_t end) {
+  const HistogramJob *job = (const HistogramJob *)arg;
+  const Heightmap *map = job->map;
+  for (size_t band = begin; band < end; ++band) {
+    int64_t *counts = job->counts + band * (SEALEVEL_BINS + 1);
+    int y0 = map->height * band / job->nBands;
+    int y1 = map->height * (band + 1) / job->nBands;
+    for (int y = y0; y < y1; ++y) {
+      const float *row = heightmapRow(map, y);
+      for (int x = 0; x < map->width; ++x) {
+        counts[sealevelBin(row[x])]++;
+      }
+    }
+  }
+}
+
+// The same bisection the search always did, with each count of cells below
+// the candidate level read from the histogram's prefix sums.
+static float bisectSealevel(const int64_t *counts, int64_t totalCells,
+                            float waterThreshold) {
+  int64_t below[SEALEVEL_BINS + 1];
+  below[0] = 0;
+  for (int b = 0; b < SEALEVEL_BINS; ++b) {
+    below[b + 1] = below[b] + counts[b];
+  }
+  float lowerBound = 0;
+  float upperBound = 1.0f;
+  float sealevel = 0;
+  while (upperBound - lowerBound > 0.001f) {
+    sealevel = (lowerBound + upperBound) / 2.0f;
+    int64_t n = below[(int)(sealevel * SEALEVEL_BINS)];
+    float percentage = (float)(n) / totalCells;
+    if (percentage < waterThreshold) {
+      lowerBound = sealevel;
+    } else {
+      upperBound = sealevel;
+    }
+  }
+  return sealevel;
+}
+
+// Exact: gives the same level as bisecting over full map scans. Bands of rows
+// are binned on nThreads threads and their integer counts summed in order.
+float getSealevel(const Heightmap *map, float waterThreshold,
+                  size_t nThreads) {
+  size_t nBands = threadCount(nThreads);
+  int64_t *counts =
+      (int64_t *)calloc((nBands + 1) * (SEALEVEL_BINS + 1), sizeof(int64_t));
+  if (counts == NULL) {
+    fprintf(stderr, "Memory allocation failed for sealevel histogram.\n");
+    return 0.5f;
+  }
+  HistogramJob job = {map, nBands, counts + SEALEVEL_BINS + 1};
+  parallelFor(nBands, nBands, histogramTask, &job);
+  for (size_t band = 0; band < nBands; ++band) {
+    for (int b = 0; b <= SEALEVEL_BINS; ++b) {
+      counts[b] += job.counts[band * (SEALEVEL_BINS + 1) + b];
+    }
+  }
+  float sealevel = bisectSealevel(
+      counts, (int64_t)map->width * map->height, waterThreshold);
+  free(counts);
+  return sealevel;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Estimate from nSamples cells picked uniformly at random (with a fixed seed,
+// so the result is reproducible and rand() is left alone). By the
+// Dvoretzky-Kiefer-Wolfowitz inequality the sampled share of water at every
+// level is within *shareError of the map's with 99.9% confidence, on top of
+// the 1 / SEALEVEL_BINS resolution the exact search has too.
+float getSealevelSampled(const Heightmap *map, float waterThreshold,
+                         size_t nSamples, float *shareError) {
+  int64_t counts[SEALEVEL_BINS + 1] = {0};
+  uint64_t state = 0x5EA1E7E1ULL;
+  uint64_t cells = (uint64_t)map->width * map->height;
+  for (size_t i = 0; i < nSamples; ++i) {
+    uint64_t cell = splitmix64(&state) % cells;
+    counts[sealevelBin(map->data[cell / map->width * map->stride +
+                                 cell % map->width])]++;
+  }
+  *shareError = sqrtf(logf(2 / 0.001f) / (2.0f * nSamples));
+  return bisectSealevel(counts, nSamples, waterThreshold);
+}
+
+static void freePoints(Vector **points, size_t nLayers) {
+  for (size_t i = 0; i < nLayers; ++i) {
+    free(points[i]);
+  }
+  free(points);
+}
+
+// Everything is set up in the same order as before the pipeline was split
+// out of main, so a seed gives the same world from rand() as it always did.
+bool generator_init(Generator *generator, const Config *config) {
+  generator->config = *config;
+  generator->sealevel = 0.5;
+  generator->sealevelError = 0;
+  generator->iteration = 0;
+  atomic_init(&generator->stage, STAGE_HEIGHTMAP);
+  atomic_init(&generator->completed, 0);
+  generator->times = (GeneratorTimes){0};
+  generator->pass = (ErosionPass){0};
+  generator->unit = 0;
+  generator->min = 0;
+  generator->max = 1;
+  for (int stage = 0; stage < STAGE_DONE; ++stage) {
+    generator->unitCost[stage] = 0;
+  }
+  srand(config->seed);
+
+  Vector **points = (Vector **)calloc(config->nLayers, sizeof(Vector *));
+  if (points == NULL) {
+    fprintf(stderr, "Memory allocation failed for points array.\n");
+    return false;
+  }
+  for (size_t i = 0; i < (size_t)config->nLayers; ++i) {
+    Vector *p = (Vector *)calloc(config->nStartPoints + i, sizeof(Vector));
+    if (p == NULL) {
+      fprintf(stderr, "Memmory allocation failed for layer %zu.\n", i);
+      freePoints(points, i);
+      return false;
+    }
+
+    for (size_t j = 0; j < config->nStartPoints + i; ++j) {
+      float x = (float)(rand() % (config->worldWidth));
+      float y = (float)(rand() % (config->worldHeight));
+      Vector v;
+      v.x = x;
+      v.y = y;
+      p[j] = v;
+    }
+    points[i] = p;
+  }
+  generator->points = points;
+
+  erode_init(&generator->erosion, config);
+  if (!continents_init(&generator->continents, points, config)) {
+    free_erode(&generator->erosion);
+    freePoints(points, config->nLayers);
+    return false;
+  }
+  open_simplex_noise(config->seed, &generator->ctx);
+
+  const int width = config->worldWidth, height = config->worldHeight;
+  generator->map.data = NULL;
+  generator->heightMap.data = NULL;
+  generator->view.data = NULL;
+  generator->heightGen.octaves = NULL;
+  if (!heightmap_init(&generator->map, width, height) ||
+      !heightmap_init(&generator->heightMap, width, height) ||
+      !heightmap_init(&generator->view, width, height) ||
+      !heightgen_init(&generator->heightGen, config)) {
+    free_generator(generator);
+    return false;
+  }
+  return true;
+}
+
+void free_generator(Generator *generator) {
+  open_simplex_noise_free(generator->ctx);
+  freePoints(generator->points, generator->config.nLayers);
+  free_continents(&generator->continents);
+  free_erode_pass(&generator->pass, &generator->erosion);
+  free_erode(&generator->erosion);
+  free_heightgen(&generator->heightGen);
+  free_heightmap(&generator->map);
+  free_heightmap(&generator->heightMap);
+  free_heightmap(&generator->view);
+}
+
+bool generatorDone(const Generator *generator) {
+  return atomic_load(&generator->stage) == STAGE_DONE;
+}
+
+const char *generatorStageName(GeneratorStage stage) {
+  switch (stage) {
+  case STAGE_HEIGHTMAP:
+    return "height map";
+  case STAGE_CONTINENTS:
+    return "continents";
+  case STAGE_NORMALIZE:
+  case STAGE_DENORMALIZE:
+    return "normalizing";
+  case STAGE_THERMAL:
+    return "weathering";
+  case STAGE_SPAWNS:
+    return "spawning droplets";
+  case STAGE_EROSION:
+    return "eroding";
+  case STAGE_SEALEVEL:
+    return "sealevel";
+  default:
+    return "done";
+  }
+}
+
+static double *stageTime(GeneratorTimes *times, GeneratorStage stage) {
+  switch (stage) {
+  case STAGE_HEIGHTMAP:
+    return &times->heightMap;
+  case STAGE_CONTINENTS:
+    return &times->continents;
+  case STAGE_THERMAL:
+  case STAGE_SPAWNS:
+  case STAGE_EROSION:
+    return &times->erosion;
+  case STAGE_SEALEVEL:
+    return &times->sealevel;
+  default:
+    return &times->normalize;
+  }
+}
+
+static bool finalPass(const Generator *generator) {
+  return generator->iteration >= generator->config.maxIterations;
+}
+
+// The fewest rows a chunk covers, so each thread still gets a useful band.
+static int leastRows(const Generator *generator) {
+  return MAX(1, UNIT_CELLS / generator->config.worldWidth);
+}
+
+// Thermal passes run at least two at a time, since an odd count ends with
+// copying the map back out of scratch.
+static int leastItems(const Generator *generator, GeneratorStage stage) {
+  switch (stage) {
+  case STAGE_HEIGHTMAP:
+    return leastRows(generator);
+  case STAGE_CONTINENTS:
+    return FUSED_CONTINENTS ? leastRows(generator) : 1;
+  case STAGE_THERMAL:
+    return 2;
+  case STAGE_SPAWNS:
+  case STAGE_EROSION:
+    return UNIT_DROPLETS;
+  default:
+    return 1;
+  }
+}
+
+// A row of continents costs about the same for each layer it adds, and the
+// number of layers changes from one iteration to the next, so their costs
+// are kept per row and layer.
+static int itemWeight(const Generator *generator, GeneratorStage stage) {
+  if (stage != STAGE_CONTINENTS || !FUSED_CONTINENTS)
+    return 1;
+  int layers = 0;
+  for (int i = 0; i < generator->config.nLayers; ++i) {
+    layers += generator->iteration % (i + 1) == 0;
+  }
+  return MAX(layers, 1);
+}
+
+static double itemCost(const Generator *generator, GeneratorStage stage) {
+  return generator->unitCost[stage] * itemWeight(generator, stage);
+}
+
+// How many of the remaining rows, passes or droplets fit in half of left
+// seconds at what one has been costing. None of them change the map by how
+// they are split, so these stages run as much as the time allows. Costs vary
+// across the map, so taking half at a time leaves the scheduler a look at the
+// clock before the rest and only misjudges ever smaller pieces.
+static int itemsThatFit(const Generator *generator, GeneratorStage stage,
+                        double left, int remaining) {
+  const int least = leastItems(generator, stage);
+  const double cost = itemCost(generator, stage);
+  if (isinf(left))
+    return remaining;
+  double fit = cost > 0 ? 0.5 * left / cost : least;
+  if (fit < least)
+    fit = least;
+  return fit < remaining ? (int)fit : remaining;
+}
+
+// The grid and pyramid engines run a whole pass as one unit.
+static bool dropletPass() { return !GRID_EROSION && !PYRAMID_EROSION; }
+
+static int passDroplets(const Generator *generator) {
+  return generator->config.droplets * (finalPass(generator) ? 10 : 1);
+}
+
+// Droplet passes are set up and run a part at a time through an ErosionPass,
+// which comes out the same however the parts fall. Returns true once the
+// pass is done.
+static bool erodeUnit(Generator *generator, double left, int *items) {
+  Heightmap *map = &generator->map;
+  Erosion *erosion = &generator->erosion;
+  ErosionPass *pass = &generator->pass;
+  const size_t nThreads = generator->config.nThreads;
+  const float sealevel = generator->sealevel;
+  const int droplets = passDroplets(generator);
+  if (GRID_EROSION) {
+    int scale = finalPass(generator) ? 10 : 1;
+    erode_grid(map, GRID_EROSION_STEPS * scale, sealevel, nThreads);
+    return true;
+  }
+  if (PYRAMID_EROSION) {
+    erode_pyramid(erosion, map, droplets / PYRAMID_BUDGET, sealevel, nThreads,
+                  rand());
+    return true;
+  }
+  *items = erodePassRun(
+      pass, erosion, map,
+      itemsThatFit(generator, STAGE_EROSION, left, droplets - pass->ran),
+      sealevel, nThreads);
+  if (!pass->done)
+    return false;
+  free_erode_pass(pass, erosion);
+  return true;
+}
+
+// Random reads cost more than a sweep, so sampling only pays off once the map
+// dwarfs the sample.
+static void updateSealevel(Generator *generator) {
+  const Config *config = &generator->config;
+  const Heightmap *view = &generator->view;
+  if ((size_t)view->width * view->height > 16 * (size_t)SEALEVEL_SAMPLES) {
+    generator->sealevel =
+        getSealevelSampled(view, config->waterThreshold, SEALEVEL_SAMPLES,
+                           &generator->sealevelError);
+  } else {
+    generator->sealevel =
+        getSealevel(view, config->waterThreshold, config->nThreads);
+    generator->sealevelError = 0;
+  }
+}
+
+// Ends the run when a stage cannot go on, leaving view with the last
+// finished iteration. Returns false, as no iteration finished.
+static bool stopGenerator(Generator *generator) {
+  fprintf(stderr, "Generation stopped after %d iterations.\n",
+          atomic_load(&generator->completed));
+  atomic_store(&generator->stage, STAGE_DONE);
+  return false;
+}
+
+// Runs the next unit of the current stage, with as many rows, passes or
+// droplets as fit in left seconds, and moves on to the next stage once this
+// one is through. Returns true when that finishes an iteration.
+//
+// Erosion works on the map normalized to [0, 1]. The sweeps that get it there
+// and back are fused: adding the height map also finds the range, and
+// mapping back also writes view, so an iteration sweeps the map four times
+// around erosion where it used to take seven.
+static bool runUnit(Generator *generator, double left) {
+  const Config *config = &generator->config;
+  Heightmap *map = &generator->map;
+  const size_t nThreads = config->nThreads;
+  const size_t iteration = generator->iteration;
+  const float bias_scale = 0.0001;
+  const float rate = 1;
+  const GeneratorStage stage = atomic_load(&generator->stage);
+  GeneratorStage next = stage;
+  bool finished = false;
+  int items = 1;
+
+  double start = seconds();
+  switch (stage) {
+  case STAGE_HEIGHTMAP:
+    items = itemsThatFit(generator, stage, left, map->height - generator->unit);
+    heightGenRows(&generator->heightGen, &generator->heightMap, generator->ctx,
+                  generator->unit, generator->unit + items, nThreads);
+    generator->unit += items;
+    if (generator->unit == map->height)
+      next = finalPass(generator) ? STAGE_NORMALIZE : STAGE_CONTINENTS;
+    break;
+  case STAGE_CONTINENTS:
+    if (FUSED_CONTINENTS) {
+      int row = MAX(generator->continents.nextRow, 0);
+      items = itemsThatFit(generator, stage, left, map->height - row);
+      if (continentsRows(&generator->continents, map, items, iteration,
+                         generator->ctx, bias_scale, rate, config))
+        next = STAGE_NORMALIZE;
+    } else {
+      // One layer at a time.
+      size_t i = generator->unit;
+      while (i < (size_t)config->nLayers && iteration % (i + 1) != 0) {
+        ++i;
+      }
+      if (i < (size_t)config->nLayers) {
+        size_t length = config->nStartPoints + i;
+        relaxPoints(generator->points[i], length, config);
+        generateVoronoiNoise(map, generator->points[i], i + 1, length,
+                             generator->ctx, bias_scale, rate, config);
+      }
+      generator->unit = i + 1;
+      if (generator->unit >= config->nLayers)
+        next = STAGE_NORMALIZE;
+    }
+    break;
+  case STAGE_NORMALIZE: {
+    bool ranged;
+    if (finalPass(generator)) {
+      ranged = heightmapRange(map, &generator->min, &generator->max, nThreads);
+    } else {
+      ranged = heightmapAddScaled(map, &generator->heightMap, 10,
+                                  &generator->min, &generator->max, nThreads);
+    }
+    if (!ranged)
+      return stopGenerator(generator);
+    heightmapNormalize(map, generator->min, generator->max, nThreads);
+    if (THERMAL_EROSION)
+      next = STAGE_THERMAL;
+    else
+      next = dropletPass() ? STAGE_SPAWNS : STAGE_EROSION;
+    break;
+  }
+  case STAGE_THERMAL:
+    items = itemsThatFit(generator, stage, left,
+                         THERMAL_ITERATIONS - generator->unit);
+    thermalErode(map, items, nThreads);
+    generator->unit += items;
+    if (generator->unit >= THERMAL_ITERATIONS)
+      next = dropletPass() ? STAGE_SPAWNS : STAGE_EROSION;
+    break;
+  case STAGE_SPAWNS: {
+    ErosionPass *pass = &generator->pass;
+    if (generator->unit++ == 0 &&
+        !erode_pass_init(pass, &generator->erosion, passDroplets(generator),
+                         rand())) {
+      pass->done = true;
+      next = STAGE_EROSION;
+      break;
+    }
+    items = erodePassSpawn(
+        pass, &generator->erosion, map,
+        itemsThatFit(generator, stage, left,
+                     pass->numIterations - pass->planned),
+        generator->sealevel, nThreads);
+    if (pass->planned == pass->numIterations)
+      next = STAGE_EROSION;
+    break;
+  }
+  case STAGE_EROSION:
+    if (erodeUnit(generator, left, &items)) {
+      generator->iteration++;
+      next = STAGE_DENORMALIZE;
+    }
+    break;
+  case STAGE_DENORMALIZE:
+    if (!heightmapDenormalize(map, generator->min, generator->max,
+                              &generator->view, nThreads))
+      return stopGenerator(generator);
+    if (generator->iteration % 10 == 0)
+      next = STAGE_SEALEVEL;
+    else
+      finished = true;
+    break;
+  case STAGE_SEALEVEL:
+    updateSealevel(generator);
+    finished = true;
+    break;
+  default:
+    return false;
+  }
+  double elapsed = seconds() - start;
+  *stageTime(&generator->times, stage) += elapsed;
+  double *cost = &generator->unitCost[stage];
+  double each = elapsed / MAX(items, 1) / itemWeight(generator, stage);
+  *cost = *cost > 0 ? 0.75 * *cost + 0.25 * each : each;
+
+  if (finished) {
+    atomic_store(&generator->completed, generator->iteration);
+    if (generator->iteration > config->maxIterations)
+      next = STAGE_DONE;
+    else
+      next = finalPass(generator) ? STAGE_NORMALIZE : STAGE_CONTINENTS;
+  }
+  if (next != stage)
+    generator->unit = 0;
+  atomic_store(&generator->stage, next);
+  return finished;
+}
+
+// Returns false once the world is done and there is nothing left to run.
+bool generatorStep(Generator *generator) {
+  if (generatorDone(generator))
+    return false;
+  while (!runUnit(generator, INFINITY) && !generatorDone(generator)) {
+  }
+  return true;
+}
+
+// Starts no unit that the recent cost of its stage says would overrun the
+// budget, except that the first always runs so the world keeps moving.
+// Returns true if an iteration finished, and so view holds a new map.
+bool generatorRun(Generator *generator, double budget) {
+  const double start = seconds();
+  bool finished = false;
+  for (bool first = true; !generatorDone(generator); first = false) {
+    double left = budget - (seconds() - start);
+    GeneratorStage stage = atomic_load(&generator->stage);
+    double least = itemCost(generator, stage) * leastItems(generator, stage);
+    if (!first && (left <= 0 || least > left))
+      break;
+    if (runUnit(generator, left))
+      finished = true;
+  }
+  return finished;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "common.h"
+#include "config.h"
+#include "continent.h"
+#include "erosion.h"
+#include "heightgen.h"
+#include "heightmap.h"
+#include "open-simplex-noise.h"
+#include <stdatomic.h>
+
+// Seconds spent in each stage so far.
+typedef struct {
+  double heightMap;
+  double continents;
+  double normalize; // to [0, 1] for erosion and back, including view
+  double erosion;
+  double sealevel;
+} GeneratorTimes;
+
+typedef enum {
+  STAGE_HEIGHTMAP,
+  STAGE_CONTINENTS,
+  STAGE_NORMALIZE,
+  STAGE_THERMAL,
+  STAGE_SPAWNS,
+  STAGE_EROSION,
+  STAGE_DENORMALIZE,
+  STAGE_SEALEVEL,
+  STAGE_DONE
+} GeneratorStage;
+
+// The whole generation pipeline, free of any windowing or GL code. The fBm
+// height map is made first; then each iteration runs the Voronoi continent
+// layers, thermal and hydraulic erosion, and every tenth iteration finds a new
+// sealevel. After config.maxIterations iterations one final, ten times longer
+// erosion pass runs, and then the world is done. When an iteration finishes,
+// view holds the map normalized to [0, 1], ready to draw, save or publish as
+// a snapshot.
+//
+// The work is split into units that can be resumed: chunks of rows for the
+// height map and the continents, thermal passes, droplet spawns, tiles of
+// droplets, or one of the whole-map sweeps. No split changes the world a seed
+// makes. generatorStep runs units until
+// an iteration finishes; generatorRun runs as many as fit a time budget, so
+// the viewer can also generate between frames without a worker thread.
+typedef struct {
+  Config config;
+  Vector **points;
+  Continents continents;
+  Erosion erosion;
+  ErosionPass pass; // the droplet pass under way
+  HeightGen heightGen;
+  struct osn_context *ctx;
+  Heightmap map, heightMap, view;
+  float sealevel;
+  float sealevelError; // bound on the water share when sampled, else 0
+  int iteration;
+  GeneratorTimes times;
+  // Progress that other threads can poll while a step is running.
+  atomic_int stage;     // GeneratorStage
+  atomic_int completed; // iterations finished, the final pass included
+  // Where the running stage has got to: rows, passes or layers done, the
+  // range erosion's [0, 1] map was scaled from, and the seconds one row,
+  // pass, droplet or unit of each stage has been taking.
+  int unit;
+  float min, max;
+  double unitCost[STAGE_DONE];
+} Generator;
+
+bool generator_init(Generator *generator, const Config *config);
+void free_generator(Generator *generator);
+bool generatorStep(Generator *generator);
+bool generatorRun(Generator *generator, double budget);
+bool generatorDone(const Generator *generator);
+const char *generatorStageName(GeneratorStage stage);
+
+float getSealevel(const Heightmap *map, float waterThreshold,
+                  size_t nThreads);
+float getSealevelSampled(const Heightmap *map, float waterThreshold,
+                         size_t nSamples, float *shareError);
@@ -0,0 +1,144 @@
+// Headless batch generation. Runs the same pipeline as the windowed viewer,
+// but back to back with no window or GL, then writes the world to disk and
+// prints how long each stage took:
+//
+//   <output>.pgm  16-bit grey heights, normalized to the full range
+//   <output>.ppm  the viewer's colour map at the final sealevel
+//
+// Both images have north at the top, as the window shows them. Progress goes
+// to stdout and the timing summary to stderr.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "colors.h"
+#include "common.h"
+#include "config.h"
+#include "generator.h"
+#include "heightmap.h"
+
+static double seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static FILE *openOutput(const char *prefix, const char *extension) {
+  size_t length = strlen(prefix) + strlen(extension) + 1;
+  char *path = (char *)malloc(length);
+  if (path == NULL) {
+    fprintf(stderr, "Memory allocation failed for output path.\n");
+    return NULL;
+  }
+  snprintf(path, length, "%s%s", prefix, extension);
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    perror(path);
+  free(path);
+  return file;
+}
+
+static bool writeHeights(const Heightmap *view, const char *prefix) {
+  FILE *file = openOutput(prefix, ".pgm");
+  if (file == NULL)
+    return false;
+  unsigned char *line = (unsigned char *)malloc((size_t)view->width * 2);
+  if (line == NULL) {
+    fprintf(stderr, "Memory allocation failed for image row.\n");
+    fclose(file);
+    return false;
+  }
+  fprintf(file, "P5\n%d %d\n65535\n", view->width, view->height);
+  for (int y = view->height - 1; y >= 0; --y) {
+    const float *row = heightmapRow(view, y);
+    for (int x = 0; x < view->width; ++x) {
+      unsigned value = (unsigned)(row[x] * 65535 + 0.5f);
+      line[2 * x] = value >> 8;
+      line[2 * x + 1] = value & 0xff;
+    }
+    fwrite(line, 2, view->width, file);
+  }
+  free(line);
+  return fclose(file) == 0;
+}
+
+static bool writeColors(const Colorizer *colorizer, const char *prefix) {
+  FILE *file = openOutput(prefix, ".ppm");
+  if (file == NULL)
+    return false;
+  unsigned char *line = (unsigned char *)malloc((size_t)colorizer->width * 3);
+  if (line == NULL) {
+    fprintf(stderr, "Memory allocation failed for image row.\n");
+    fclose(file);
+    return false;
+  }
+  fprintf(file, "P6\n%d %d\n255\n", colorizer->width, colorizer->height);
+  for (int y = colorizer->height - 1; y >= 0; --y) {
+    const unsigned char *rgba =
+        (const unsigned char *)(colorizer->pixels +
+                                (size_t)y * colorizer->width);
+    for (int x = 0; x < colorizer->width; ++x) {
+      memcpy(line + 3 * x, rgba + 4 * x, 3);
+    }
+    fwrite(line, 3, colorizer->width, file);
+  }
+  free(line);
+  return fclose(file) == 0;
+}
+
+int main(int argc, char **argv) {
+  Config config;
+  config_init(&config);
+  if (!config_parse(&config, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  double start = seconds();
+  Generator generator;
+  if (!generator_init(&generator, &config)) {
+    return EXIT_FAILURE;
+  }
+  while (generatorStep(&generator)) {
+    printf("iteration %d of %d, sealevel %f\n", generator.iteration,
+           config.maxIterations + 1, generator.sealevel);
+  }
+  double generated = seconds();
+
+  Colorizer colorizer;
+  bool written = colorizer_init(&colorizer, config.worldWidth,
+                                config.worldHeight);
+  if (written) {
+    colorize(&colorizer, &generator.view, generator.sealevel,
+             config.nThreads);
+    written = writeHeights(&generator.view, config.output) &&
+              writeColors(&colorizer, config.output);
+    free_colorizer(&colorizer);
+  }
+  double finished = seconds();
+
+  const GeneratorTimes *times = &generator.times;
+  double total = generated - start;
+  double cells = (double)config.worldWidth * config.worldHeight;
+  fprintf(stderr, "world %dx%d, %d iterations, seed %d\n", config.worldWidth,
+          config.worldHeight, config.maxIterations, config.seed);
+  fprintf(stderr, "  height map  %8.2fs\n", times->heightMap);
+  fprintf(stderr, "  continents  %8.2fs\n", times->continents);
+  fprintf(stderr, "  normalize   %8.2fs\n", times->normalize);
+  fprintf(stderr, "  erosion     %8.2fs\n", times->erosion);
+  if (generator.sealevelError > 0) {
+    fprintf(stderr, "  sealevel    %8.2fs  (final %.3f, water share within "
+                    "%.4f)\n",
+            times->sealevel, generator.sealevel, generator.sealevelError);
+  } else {
+    fprintf(stderr, "  sealevel    %8.2fs  (final %.3f)\n", times->sealevel,
+            generator.sealevel);
+  }
+  fprintf(stderr, "  generation  %8.2fs  %.0f cells/s per iteration\n",
+          total, total > 0 ? cells * (config.maxIterations + 1) / total : 0);
+  fprintf(stderr, "  output      %8.2fs  %s.pgm, %s.ppm\n",
+          finished - generated, config.output, config.output);
+
+  free_generator(&generator);
+  return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,73 +1,123 @@
 #include "heightgen.h"
 #include "common.h"
 #include "open-simplex-noise.h"
+#include "parallel.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  Heightmap *heightMap;
+  const Octave *octaves;
+  int nOctaves;
+  float scale;
+  struct osn_context *ctx;
+  size_t y0; // first row of the task's range
+} FbmJob;
 
 static float function(float x) {
   return exp(-(pow(x, 5))); /*return 1.0f / (10.f + x);*/
 }
-static void genGradients(Vector **gradients, float **heightMap,
-                         double amplitude, double frequency, Vector offset,
-                         struct osn_context *ctx) {
-  float delta = (0.00001);
-  for (size_t x = 0; x < WINDOW_WIDTH; ++x) {
-    for (size_t y = 0; y < WINDOW_HEIGHT; ++y) {
-      float newX = (x + offset.x) * SCALE / frequency;
-      float newY = (y + offset.y) * SCALE / frequency;
-      float p1 = open_simplex_noise2(ctx, newX, newY) * amplitude;
-      float px = open_simplex_noise2(ctx, newX + delta, newY) * amplitude;
-      float py = open_simplex_noise2(ctx, newX, newY + delta) * amplitude;
-      float dx = (px + amplitude) / 2 - (p1 + amplitude) / 2;
-      float dy = (py + amplitude) / 2 - (p1 + amplitude) / 2;
-      gradients[x][y].x += dx / delta;
-      gradients[x][y].y += dy / delta;
-      float grad = sqrt(gradients[x][y].x * gradients[x][y].x +
-                        gradients[x][y].y * gradients[x][y].y);
-      (heightMap)[x][y] += p1 * function(grad);
-    }
+
+static void initOctaves(Octave *octaves, const Config *config) {
+  double amplitude = 1;
+  double frequency = 1;
+  for (int o = 0; o < config->octaves; ++o) {
+    octaves[o].offset.x = RAND_IN_RANGE(-10000, 10000);
+    octaves[o].offset.y = RAND_IN_RANGE(-10000, 10000);
+    octaves[o].amplitude = amplitude;
+    octaves[o].frequency = frequency;
+    amplitude *= config->persistence;
+    frequency *= config->lacunarity;
   }
 }
 
-static void init_vector_array(Vector ***arr) {
-  *arr = (Vector **)calloc(WINDOW_WIDTH, sizeof(Vector *));
-  if (*arr == NULL) {
-    fprintf(stderr, "Memory allocation failed for gradients array.\n");
-    exit(EXIT_FAILURE);
-  }
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    (*arr)[i] = (Vector *)calloc(WINDOW_HEIGHT, sizeof(Vector));
-    if ((*arr)[i] == NULL) {
-      fprintf(stderr, "Memory allocation failed for gradients row %zu.\n", i);
-      exit(EXIT_FAILURE);
-    }
-    for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-      (*arr)[i][j].x = 0;
-      (*arr)[i][j].y = 0;
+// Runs every octave for one pixel at a time, so the gradient accumulators
+// stay in registers and each heightMap row is touched once. Consecutive pixels
+// of a row mostly share a simplex cell, so each octave keeps a lattice cache
+// for the walk along the row. Without caches every lookup goes to the
+// permutation table, which gives the same map more slowly.
+static void fbmRows(const FbmJob *job, size_t y0, size_t y1,
+                    struct osn_lattice_cache2 *caches) {
+  Heightmap *heightMap = job->heightMap;
+  const Octave *octaves = job->octaves;
+  struct osn_context *ctx = job->ctx;
+  for (size_t y = y0; y < y1; ++y) {
+    if (caches != NULL)
+      memset(caches, 0, job->nOctaves * sizeof(*caches));
+    float *row = heightmapRow(heightMap, y);
+    for (size_t x = 0; x < (size_t)heightMap->width; ++x) {
+      float gradientX = 0;
+      float gradientY = 0;
+      float height = row[x];
+      for (int o = 0; o < job->nOctaves; ++o) {
+        double amplitude = octaves[o].amplitude;
+        double frequency = octaves[o].frequency;
+        float newX = (x + octaves[o].offset.x) * job->scale / frequency;
+        float newY = (y + octaves[o].offset.y) * job->scale / frequency;
+        double dx, dy;
+        float p1 = open_simplex_noise2_deriv_cached(
+                       ctx, caches != NULL ? &caches[o] : NULL, newX, newY,
+                       &dx, &dy) *
+                   amplitude;
+        // Slope of the noise remapped to [0, amplitude]: (p + amplitude) / 2.
+        gradientX += dx * amplitude / 2;
+        gradientY += dy * amplitude / 2;
+        float grad =
+            sqrt(gradientX * gradientX + gradientY * gradientY);
+        height += p1 * function(grad);
+      }
+      row[x] = height;
     }
   }
 }
 
-void heightMapGen(float **heightMap, struct osn_context *ctx) {
-  printf("0\n");
-  Vector **gradients;
-  printf("1\n");
-  init_vector_array(&gradients);
-  printf("2\n");
-  double amplitude = 1;
-  double frequency = 1;
-  for (size_t o = 0; o < OCTAVES; ++o) {
-    Vector offset = {RAND_IN_RANGE(-10000, 10000),
-                     RAND_IN_RANGE(-10000, 10000)};
-    printf("%zu\n", o);
-    genGradients(gradients, heightMap, amplitude, frequency, offset, ctx);
-    printf("%zu\n", o);
-    amplitude *= PERSISTENCE;
-    frequency *= LACUNARITY;
-  }
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    free(gradients[i]);
+static void fbmTask(void *arg, size_t begin, size_t end) {
+  FbmJob *job = (FbmJob *)arg;
+  struct osn_lattice_cache2 *caches = (struct osn_lattice_cache2 *)calloc(
+      job->nOctaves, sizeof(struct osn_lattice_cache2));
+  if (caches == NULL)
+    fprintf(stderr, "Memory allocation failed for lattice caches, running "
+                    "the band uncached.\n");
+  fbmRows(job, job->y0 + begin, job->y0 + end, caches);
+  free(caches);
+}
+
+// Offsets are drawn from rand() before any work is split, and each pixel only
+// reads the shared octaves and noise context, so every thread count and
+// every split into rows produces the same map.
+bool heightgen_init(HeightGen *gen, const Config *config) {
+  gen->octaves = (Octave *)calloc(config->octaves, sizeof(Octave));
+  if (gen->octaves == NULL) {
+    fprintf(stderr, "Memory allocation failed for octaves.\n");
+    return false;
   }
-  free(gradients);
+  gen->nOctaves = config->octaves;
+  gen->scale = config->scale;
+  initOctaves(gen->octaves, config);
+  return true;
+}
+
+void free_heightgen(HeightGen *gen) {
+  free(gen->octaves);
+  gen->octaves = NULL;
+}
+
+void heightGenRows(const HeightGen *gen, Heightmap *heightMap,
+                   struct osn_context *ctx, int y0, int y1,
+                   size_t nThreads) {
+  FbmJob job = {heightMap, gen->octaves, gen->nOctaves,
+                gen->scale, ctx,          (size_t)y0};
+  parallelFor(y1 - y0, nThreads, fbmTask, &job);
+}
+
+void heightMapGen(Heightmap *heightMap, const Config *config,
+                  struct osn_context *ctx) {
+  HeightGen gen;
+  if (!heightgen_init(&gen, config))
+    return;
+  heightGenRows(&gen, heightMap, ctx, 0, heightMap->height,
+                config->nThreads);
+  free_heightgen(&gen);
 }
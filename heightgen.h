@@ -1,6 +1,28 @@
 #pragma once
 
 #include "common.h"
+#include "config.h"
+#include "heightmap.h"
 #include "open-simplex-noise.h"
 
-void heightMapGen(float **heightMap, struct osn_context *ctx);
+typedef struct {
+  Vector offset;
+  double amplitude;
+  double frequency;
+} Octave;
+
+// The fBm height map in resumable pieces: heightgen_init draws the octave
+// offsets from rand(), and heightGenRows adds the noise for rows [y0, y1).
+// heightMapGen does the whole map at once.
+typedef struct {
+  Octave *octaves;
+  int nOctaves;
+  float scale;
+} HeightGen;
+
+bool heightgen_init(HeightGen *gen, const Config *config);
+void free_heightgen(HeightGen *gen);
+void heightGenRows(const HeightGen *gen, Heightmap *heightMap,
+                   struct osn_context *ctx, int y0, int y1, size_t nThreads);
+void heightMapGen(Heightmap *heightMap, const Config *config,
+                  struct osn_context *ctx);
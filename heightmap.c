@@ -0,0 +1,306 @@
+#include "heightmap.h"
+#include "common.h"
+#include "parallel.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define HEIGHTMAP_SIMD 1
+#include <immintrin.h>
+#endif
+
+bool heightmap_init(Heightmap *map, int width, int height) {
+  map->width = width;
+  map->height = height;
+  map->stride = width;
+  size_t bytes = (size_t)map->stride * height * sizeof(float);
+  // aligned_alloc wants a whole number of alignment units.
+  size_t padded = (bytes + HEIGHTMAP_ALIGNMENT - 1) /
+                  HEIGHTMAP_ALIGNMENT * HEIGHTMAP_ALIGNMENT;
+  map->data = (float *)aligned_alloc(HEIGHTMAP_ALIGNMENT, padded);
+  if (map->data == NULL) {
+    fprintf(stderr, "Memory allocation failed for %dx%d heightmap.\n", width,
+            height);
+    return false;
+  }
+  memset(map->data, 0, padded);
+  return true;
+}
+
+void free_heightmap(Heightmap *map) {
+  free(map->data);
+  map->data = NULL;
+}
+
+void heightmapCopy(Heightmap *dst, const Heightmap *src) {
+  memcpy(dst->data, src->data,
+         (size_t)src->stride * src->height * sizeof(float));
+}
+
+// The normalize kernels below are bound by memory bandwidth, so each one
+// makes a single sweep over the map in bands of rows, one band per thread,
+// eight cells at a time where AVX2 is available. They compute the same
+// expressions as MAP() in the same order, so the results match the scalar
+// loops exactly.
+typedef struct {
+  const Heightmap *map; // read by every sweep
+  Heightmap *dst;       // the same map for sweeps that write it, else NULL
+  const Heightmap *src;
+  Heightmap *view;
+  float scale;
+  float min, max, viewMin, viewMax;
+  size_t nBands;
+  float *mins, *maxs; // one per band
+} NormalizeJob;
+
+static void rowRange(const float *row, int width, float *min, float *max) {
+  for (int x = 0; x < width; ++x) {
+    if (row[x] < *min)
+      *min = row[x];
+    if (row[x] > *max)
+      *max = row[x];
+  }
+}
+
+static void rowAddScaled(float *row, const float *src, float scale, int width,
+                         float *min, float *max) {
+  for (int x = 0; x < width; ++x) {
+    row[x] += scale * src[x];
+  }
+  rowRange(row, width, min, max);
+}
+
+static void rowNormalize(float *row, int width, float min, float max) {
+  for (int x = 0; x < width; ++x) {
+    row[x] = MAP(row[x], min, max, 0, 1);
+  }
+}
+
+static void rowDenormalize(float *row, float *view, int width,
+                           const NormalizeJob *job) {
+  for (int x = 0; x < width; ++x) {
+    row[x] = MAP(row[x], 0, 1, job->min, job->max);
+    if (view != NULL)
+      view[x] = MAP(row[x], job->viewMin, job->viewMax, 0, 1);
+  }
+}
+
+#ifdef HEIGHTMAP_SIMD
+// Each returns the first column left for the scalar loop.
+__attribute__((target("avx2"))) static int
+rowRangeAVX2(const float *row, int width, float *min, float *max) {
+  __m256 lo = _mm256_set1_ps(*min), hi = _mm256_set1_ps(*max);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256 v = _mm256_loadu_ps(row + x);
+    lo = _mm256_min_ps(v, lo); // keeps lo where v is NaN, like the compares
+    hi = _mm256_max_ps(v, hi);
+  }
+  float los[8], his[8];
+  _mm256_storeu_ps(los, lo);
+  _mm256_storeu_ps(his, hi);
+  rowRange(los, 8, min, max);
+  rowRange(his, 8, min, max);
+  return x;
+}
+
+__attribute__((target("avx2"))) static int
+rowAddScaledAVX2(float *row, const float *src, float scale, int width,
+                 float *min, float *max) {
+  const __m256 s = _mm256_set1_ps(scale);
+  __m256 lo = _mm256_set1_ps(*min), hi = _mm256_set1_ps(*max);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256 v = _mm256_add_ps(_mm256_loadu_ps(row + x),
+                             _mm256_mul_ps(s, _mm256_loadu_ps(src + x)));
+    _mm256_storeu_ps(row + x, v);
+    lo = _mm256_min_ps(v, lo);
+    hi = _mm256_max_ps(v, hi);
+  }
+  float los[8], his[8];
+  _mm256_storeu_ps(los, lo);
+  _mm256_storeu_ps(his, hi);
+  rowRange(los, 8, min, max);
+  rowRange(his, 8, min, max);
+  return x;
+}
+
+__attribute__((target("avx2"))) static int
+rowNormalizeAVX2(float *row, int width, float min, float max) {
+  const __m256 lo = _mm256_set1_ps(min), range = _mm256_set1_ps(max - min);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256 v = _mm256_sub_ps(_mm256_loadu_ps(row + x), lo);
+    _mm256_storeu_ps(row + x, _mm256_div_ps(v, range));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) static int
+rowDenormalizeAVX2(float *row, float *view, int width,
+                   const NormalizeJob *job) {
+  const __m256 lo = _mm256_set1_ps(job->min);
+  const __m256 range = _mm256_set1_ps(job->max - job->min);
+  const __m256 viewLo = _mm256_set1_ps(job->viewMin);
+  const __m256 viewRange = _mm256_set1_ps(job->viewMax - job->viewMin);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256 v =
+        _mm256_add_ps(lo, _mm256_mul_ps(range, _mm256_loadu_ps(row + x)));
+    _mm256_storeu_ps(row + x, v);
+    if (view != NULL)
+      _mm256_storeu_ps(view + x,
+                       _mm256_div_ps(_mm256_sub_ps(v, viewLo), viewRange));
+  }
+  return x;
+}
+
+#endif
+
+static void bandRows(const NormalizeJob *job, size_t band, int *y0, int *y1) {
+  *y0 = job->map->height * band / job->nBands;
+  *y1 = job->map->height * (band + 1) / job->nBands;
+}
+
+static void rangeTask(void *arg, size_t begin, size_t end) {
+  NormalizeJob *job = (NormalizeJob *)arg;
+  const int width = job->map->width;
+  for (size_t band = begin; band < end; ++band) {
+    float min = FLT_MAX, max = -FLT_MAX;
+    int y0, y1;
+    bandRows(job, band, &y0, &y1);
+    for (int y = y0; y < y1; ++y) {
+      int x = 0;
+      if (job->src != NULL) {
+        float *row = heightmapRow(job->dst, y);
+        const float *src = heightmapRow(job->src, y);
+#ifdef HEIGHTMAP_SIMD
+        if (haveAVX2())
+          x = rowAddScaledAVX2(row, src, job->scale, width, &min, &max);
+#endif
+        rowAddScaled(row + x, src + x, job->scale, width - x, &min, &max);
+      } else {
+        const float *row = heightmapRow(job->map, y);
+#ifdef HEIGHTMAP_SIMD
+        if (haveAVX2())
+          x = rowRangeAVX2(row, width, &min, &max);
+#endif
+        rowRange(row + x, width - x, &min, &max);
+      }
+    }
+    job->mins[band] = min;
+    job->maxs[band] = max;
+  }
+}
+
+static void normalizeTask(void *arg, size_t begin, size_t end) {
+  NormalizeJob *job = (NormalizeJob *)arg;
+  const int width = job->map->width;
+  for (size_t band = begin; band < end; ++band) {
+    int y0, y1;
+    bandRows(job, band, &y0, &y1);
+    for (int y = y0; y < y1; ++y) {
+      float *row = heightmapRow(job->dst, y);
+      int x = 0;
+#ifdef HEIGHTMAP_SIMD
+      if (haveAVX2())
+        x = rowNormalizeAVX2(row, width, job->min, job->max);
+#endif
+      rowNormalize(row + x, width - x, job->min, job->max);
+    }
+  }
+}
+
+static void denormalizeTask(void *arg, size_t begin, size_t end) {
+  NormalizeJob *job = (NormalizeJob *)arg;
+  const int width = job->map->width;
+  for (size_t band = begin; band < end; ++band) {
+    int y0, y1;
+    bandRows(job, band, &y0, &y1);
+    for (int y = y0; y < y1; ++y) {
+      float *row = heightmapRow(job->dst, y);
+      float *view = job->view != NULL ? heightmapRow(job->view, y) : NULL;
+      int x = 0;
+#ifdef HEIGHTMAP_SIMD
+      if (haveAVX2())
+        x = rowDenormalizeAVX2(row, view, width, job);
+#endif
+      rowDenormalize(row + x, view != NULL ? view + x : NULL, width - x, job);
+    }
+  }
+}
+
+// Runs the range sweep and merges the per-band results. With src set, the
+// sweep also adds scale * src to the map first. Returns false, with the map
+// untouched, if the per-band results cannot be allocated.
+static bool sweepRange(NormalizeJob *job, size_t nThreads, float *min,
+                       float *max) {
+  *min = FLT_MAX;
+  *max = -FLT_MAX;
+  job->mins = (float *)malloc(2 * job->nBands * sizeof(float));
+  if (job->mins == NULL) {
+    fprintf(stderr, "Memory allocation failed for heightmap range.\n");
+    return false;
+  }
+  job->maxs = job->mins + job->nBands;
+  parallelFor(job->nBands, nThreads, rangeTask, job);
+  rowRange(job->mins, job->nBands, min, max);
+  rowRange(job->maxs, job->nBands, min, max);
+  free(job->mins);
+  return true;
+}
+
+static size_t normalizeBands(const Heightmap *map, size_t nThreads) {
+  size_t nBands = threadCount(nThreads);
+  return nBands < (size_t)map->height ? nBands : (size_t)map->height;
+}
+
+bool heightmapRange(const Heightmap *map, float *min, float *max,
+                    size_t nThreads) {
+  NormalizeJob job = {.map = map, .nBands = normalizeBands(map, nThreads)};
+  return sweepRange(&job, nThreads, min, max);
+}
+
+bool heightmapAddScaled(Heightmap *map, const Heightmap *src, float scale,
+                        float *min, float *max, size_t nThreads) {
+  NormalizeJob job = {.map = map,
+                      .dst = map,
+                      .src = src,
+                      .scale = scale,
+                      .nBands = normalizeBands(map, nThreads)};
+  return sweepRange(&job, nThreads, min, max);
+}
+
+void heightmapNormalize(Heightmap *map, float min, float max,
+                        size_t nThreads) {
+  NormalizeJob job = {.map = map,
+                      .dst = map,
+                      .min = min,
+                      .max = max,
+                      .nBands = normalizeBands(map, nThreads)};
+  parallelFor(job.nBands, nThreads, normalizeTask, &job);
+}
+
+// Mapping is monotonic, so the range of the denormalized map is the mapped
+// range of the normalized one, and view can be written in the same sweep.
+bool heightmapDenormalize(Heightmap *map, float min, float max,
+                          Heightmap *view, size_t nThreads) {
+  NormalizeJob job = {.map = map,
+                      .dst = map,
+                      .view = view,
+                      .min = min,
+                      .max = max,
+                      .nBands = normalizeBands(map, nThreads)};
+  if (view != NULL) {
+    float low, high;
+    if (!heightmapRange(map, &low, &high, nThreads))
+      return false;
+    job.viewMin = MAP(low, 0, 1, min, max);
+    job.viewMax = MAP(high, 0, 1, min, max);
+  }
+  parallelFor(job.nBands, nThreads, denormalizeTask, &job);
+  return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "common.h"
+#include <stddef.h>
+
+// A flat row-major grid of heights: cell (x, y) is data[y * stride + x].
+// Rows are packed, so stride == width and the whole map is one contiguous
+// block the erosion engines can walk as a flat array. The block is aligned to
+// HEIGHTMAP_ALIGNMENT bytes for the SIMD kernels.
+#define HEIGHTMAP_ALIGNMENT 64
+
+typedef struct {
+  int width, height;
+  int stride; // floats from one row to the next
+  float *data;
+} Heightmap;
+
+bool heightmap_init(Heightmap *map, int width, int height);
+void free_heightmap(Heightmap *map);
+void heightmapCopy(Heightmap *dst, const Heightmap *src);
+
+// Single-sweep kernels for keeping a map normalized to [0, 1] while it is
+// eroded. heightmapAddScaled adds scale * src to the map and returns the
+// range of the result. heightmapDenormalize maps [0, 1] back onto
+// [min, max] and, when view is not NULL, also writes the result normalized
+// to its own range into view. Those that find a range return false, leaving
+// the map untouched, if they run out of memory.
+bool heightmapRange(const Heightmap *map, float *min, float *max,
+                    size_t nThreads);
+bool heightmapAddScaled(Heightmap *map, const Heightmap *src, float scale,
+                        float *min, float *max, size_t nThreads);
+void heightmapNormalize(Heightmap *map, float min, float max,
+                        size_t nThreads);
+bool heightmapDenormalize(Heightmap *map, float min, float max,
+                          Heightmap *view, size_t nThreads);
+
+static inline float *heightmapRow(const Heightmap *map, int y) {
+  return map->data + (size_t)y * map->stride;
+}
@@ -1,268 +1,166 @@
 #include <GL/gl.h>
 #include <GLFW/glfw3.h>
-#include <float.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 #include "colors.h"
 #include "common.h"
-#include "continent.h"
-#include "erosion.h"
-#include "heightgen.h"
+#include "config.h"
+#include "generator.h"
+#include "heightmap.h"
 #include "open-simplex-noise.h"
-
-void normalizeMap(float **map, float *min, float *max) {
-  *min = FLT_MAX;
-  *max = -FLT_MAX;
-
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-      if (map[i][j] > *max)
-        *max = map[i][j];
-      else if (map[i][j] < *min)
-        *min = map[i][j];
-    }
-  }
-
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-      map[i][j] = MAP(map[i][j], *min, *max, 0, 1);
-    }
-  }
-}
-
-float getSealevel(float **map) {
-  float lowerBound = 0;
-  float upperBound = 1.0f;
-  float sealevel = 0;
-  int totalCells = WINDOW_WIDTH * WINDOW_HEIGHT;
-  while (upperBound - lowerBound > 0.001f) {
-    sealevel = (lowerBound + upperBound) / 2.0f;
-    int n = 0;
-
-    for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-      bool skip = false;
-      for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-        if (map[i][j] < sealevel) {
-          n++;
-        }
-      }
-    }
-    float percentage = (float)(n) / totalCells;
-
-    printf("Sealevel: %.3f, Percentage: %.3f, n: %d, lowerBound: %.3f, "
-           "upperBound: %.3f\n",
-           sealevel, percentage, n, lowerBound, upperBound);
-
-    if (percentage < WATER_THRESHOLD) {
-      lowerBound = sealevel;
-    } else {
-      upperBound = sealevel;
-    }
-  }
-
-  return sealevel;
-}
-
-void drawMap(struct osn_context *ctx, float **map, float *heights,
-             float sealevel) {
-  glClear(GL_COLOR_BUFFER_BIT);
-
-  glBegin(GL_POINTS);
-  for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-    for (int x = 0; x < WINDOW_WIDTH; ++x) {
-      float value = map[x][y];
-      Color rgb = getColor(heights, value, sealevel);
-      glColor3f(rgb.r, rgb.g, rgb.b);
-      glVertex2i(x, y);
-    }
-  }
-  glEnd();
-}
-
-void oneDimensionalArrayToTwoDimensional(float *oneDimensionalArray,
-                                         float **twoDimensionalArray) {
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-      twoDimensionalArray[i][j] = oneDimensionalArray[i + j * WINDOW_WIDTH];
-    }
-  }
-}
-
-void twoDimensionalArrayToOneDimensionalArray(float *oneDimensionalArray,
-                                              float **twoDimensionalArray) {
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-      oneDimensionalArray[i + j * WINDOW_WIDTH] = twoDimensionalArray[i][j];
+#include "renderer.h"
+#include "snapshot.h"
+
+// Generation runs on its own thread and hands each finished iteration to the
+// window through a triple buffer, so the window keeps drawing and handling
+// events at display rate however long an erosion pass takes. With --budget
+// there is no thread: each frame runs the generator for that long first.
+typedef struct {
+  Generator *generator;
+  SnapshotBuffer *snapshots;
+  atomic_bool stop;
+} Worker;
+
+static void *generate(void *arg) {
+  Worker *worker = (Worker *)arg;
+  Generator *generator = worker->generator;
+  // Runs in short slices rather than whole iterations, so a stop request
+  // waits for at most a slice instead of the rest of an erosion pass.
+  while (!atomic_load(&worker->stop) && !generatorDone(generator)) {
+    if (generatorRun(generator, WORKER_SLICE / 1000.0)) {
+      snapshotPublish(worker->snapshots, &generator->view,
+                      generator->sealevel, generator->iteration);
     }
   }
+  return NULL;
 }
 
-float *init1DArray(size_t size) {
-  float *array = (float *)calloc(size, sizeof(float));
-  for (size_t i = 0; i < size; ++i) {
-    array[i] = 0;
-  }
-  return array;
+// Shows which iteration and stage the generator is in, read from its
+// progress atomics.
+static void showProgress(GLFWwindow *window, Generator *generator,
+                         int *shownCompleted, int *shownStage) {
+  int completed = atomic_load(&generator->completed);
+  int stage = atomic_load(&generator->stage);
+  if (completed == *shownCompleted && stage == *shownStage)
+    return;
+  char title[96];
+  if (stage == STAGE_DONE) {
+    snprintf(title, sizeof(title), "Checkerboard - done");
+  } else {
+    snprintf(title, sizeof(title), "Checkerboard - iteration %d of %d, %s",
+             completed + 1, generator->config.maxIterations + 1,
+             generatorStageName(stage));
+  }
+  glfwSetWindowTitle(window, title);
+  *shownCompleted = completed;
+  *shownStage = stage;
 }
 
-float **init2DArray() {
-  float **array =
-      (float **)calloc(WINDOW_WIDTH * WINDOW_HEIGHT, sizeof(float *));
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    array[i] = init1DArray(WINDOW_HEIGHT);
-  }
-  return array;
-}
-
-void free2DArray(float **array) {
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    free(array[i]);
+int main(int argc, char **argv) {
+  Config config;
+  config_init(&config);
+  if (!config_parse(&config, argc, argv)) {
+    return -1;
   }
-  free(array);
-}
-
-int main() {
-  srand(SEED);
   if (!glfwInit()) {
     fprintf(stderr, "Failed to initialize GLFW\n");
     return -1;
   }
 
-  GLFWwindow *window =
-      glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Checkerboard", NULL, NULL);
+  GLFWwindow *window = glfwCreateWindow(
+      config.windowWidth, config.windowHeight, "Checkerboard", NULL, NULL);
   if (!window) {
     fprintf(stderr, "Failed to open window\n");
     glfwTerminate();
     return -1;
   }
 
-  Vector **points = (Vector **)calloc(N_LAYERS, sizeof(Vector *));
-  if (points == NULL) {
-    fprintf(stderr, "Memory allocation failed for points array.\n");
+  Generator generator;
+  if (!generator_init(&generator, &config)) {
     exit(EXIT_FAILURE);
   }
-
-  for (size_t i = 0; i < N_LAYERS; ++i) {
-    Vector *p = (Vector *)calloc(N_START_POINTS + i, sizeof(Vector));
-    if (p == NULL) {
-      fprintf(stderr, "Memmory allocation failed for layer %zu.\n", i);
-      for (size_t k = 0; k < i; ++k) {
-        free(points[k]);
-      }
-      free(points);
-      exit(EXIT_FAILURE);
-    }
-
-    for (size_t j = 0; j < N_START_POINTS + i; ++j) {
-      float x = (float)(rand() % (WINDOW_WIDTH));
-      float y = (float)(rand() % (WINDOW_HEIGHT));
-      Vector v;
-      v.x = x;
-      v.y = y;
-      p[j] = v;
-    }
-    points[i] = p;
+  const bool threaded = config.frameBudget <= 0;
+  SnapshotBuffer snapshots;
+  if (threaded &&
+      !snapshots_init(&snapshots, config.worldWidth, config.worldHeight)) {
+    exit(EXIT_FAILURE);
   }
-
-  int currentIteration = 0;
-  float min = FLT_MIN;
-  float max = FLT_MAX;
-  float bias_scale = 0.0001;
-  float rate = 1;
-  float sealevel = 0.5;
-  Erosion erosion;
-
-  erode_init(&erosion);
-  struct osn_context *ctx;
-  open_simplex_noise(SEED, &ctx);
-
-  float **map = init2DArray();
-  float **tempMap = init2DArray();
-  float **heightMap = init2DArray();
-  float *m = init1DArray(WINDOW_WIDTH * WINDOW_HEIGHT);
-  float *heights;
-  initializeHeight(&heights);
-  addColors();
-
-  for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-    for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-      map[i][j] = 0;
-      heightMap[i][j] = 0;
-    }
+  Colorizer colorizer;
+  if (!colorizer_init(&colorizer, config.worldWidth, config.worldHeight)) {
+    exit(EXIT_FAILURE);
   }
-  heightMapGen(heightMap, ctx);
+
   glfwMakeContextCurrent(window);
-  glOrtho(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT, -1, 1);
+  glfwSwapInterval(1);
+  glOrtho(0, config.windowWidth, 0, config.windowHeight, -1, 1);
+  Renderer renderer;
+  renderer_init(&renderer, config.renderer, config.windowWidth,
+                config.windowHeight, config.worldWidth, config.worldHeight);
+
+  Worker worker = {.generator = &generator, .snapshots = &snapshots};
+  atomic_init(&worker.stop, false);
+  pthread_t thread;
+  if (threaded && pthread_create(&thread, NULL, generate, &worker) != 0) {
+    fprintf(stderr, "Failed to start the generation thread\n");
+    exit(EXIT_FAILURE);
+  }
 
+  // Drawing time per frame runs from the newest snapshot to the buffer
+  // swap, so it covers colouring and the driver's work for either path.
+  // Generating within the frame budget is timed apart from it.
+  double drawing = 0, generating = 0;
+  int frames = 0;
+  int shownCompleted = -1, shownStage = -1;
   while (!glfwWindowShouldClose(window)) {
-    if (currentIteration < MAX_ITERATIONS) {
-      for (size_t i = 0; i < N_LAYERS; ++i) {
-        if (currentIteration % (i + 1) == 0) {
-          relaxPoints(points[i], N_START_POINTS + i);
-          generateVoronoiNoise(map, points[i], i + 1, N_START_POINTS + i, ctx,
-                               bias_scale, rate);
-        }
-      }
-      if (true) {
-        for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-          for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-            map[i][j] += 10 * heightMap[i][j];
-          }
-        }
-      }
-      normalizeMap(map, &min, &max);
-      twoDimensionalArrayToOneDimensionalArray(m, map);
-      erode(&erosion, m, 200000, sealevel);
-      oneDimensionalArrayToTwoDimensional(m, map);
-      for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-        for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-          map[i][j] = MAP(map[i][j], 0, 1, min, max);
-        }
-      }
-      currentIteration++;
-      printf("%d\n", currentIteration);
-    } else if (currentIteration == MAX_ITERATIONS) {
-      normalizeMap(map, &min, &max);
-      twoDimensionalArrayToOneDimensionalArray(m, map);
-      erode(&erosion, m, 2000000, sealevel);
-      oneDimensionalArrayToTwoDimensional(m, map);
-      for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-        for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-          map[i][j] = MAP(map[i][j], 0, 1, min, max);
-        }
-      }
-      currentIteration++;
-    }
-    for (size_t i = 0; i < WINDOW_WIDTH; ++i) {
-      for (size_t j = 0; j < WINDOW_HEIGHT; ++j) {
-        tempMap[i][j] = map[i][j];
-      }
+    double start = glfwGetTime();
+    const Heightmap *map;
+    float sealevel;
+    bool fresh;
+    if (threaded) {
+      const Snapshot *snapshot = snapshotLatest(&snapshots, &fresh);
+      map = &snapshot->map;
+      sealevel = snapshot->sealevel;
+    } else {
+      fresh = generatorRun(&generator, config.frameBudget / 1000);
+      map = &generator.view;
+      sealevel = generator.sealevel;
+      double generated = glfwGetTime();
+      generating += generated - start;
+      start = generated;
     }
-    normalizeMap(tempMap, &max, &min);
-    if (currentIteration % 10 == 0) {
-      sealevel = getSealevel(tempMap);
-      printf("%f\n", sealevel);
+    bool changed = fresh || frames == 0;
+    if (changed) {
+      colorize(&colorizer, map, sealevel, config.nThreads);
     }
-    drawMap(ctx, tempMap, heights, sealevel);
-
+    renderFrame(&renderer, &colorizer, changed);
     glfwSwapBuffers(window);
+    drawing += glfwGetTime() - start;
+    frames++;
+    showProgress(window, &generator, &shownCompleted, &shownStage);
     glfwPollEvents();
   }
+  if (frames > 0) {
+    fprintf(stderr, "%s renderer: %.2f ms per frame over %d frames\n",
+            rendererName(&renderer), 1000 * drawing / frames, frames);
+  }
+  if (!threaded && frames > 0) {
+    fprintf(stderr, "generation: %.2f ms per frame, %.2fs in all\n",
+            1000 * generating / frames, generating);
+  }
 
+  // The window goes at once; the generator stops after its current step.
+  free_renderer(&renderer);
   glfwDestroyWindow(window);
   glfwTerminate();
-  open_simplex_noise_free(ctx);
-  for (size_t i = 0; i < N_LAYERS; ++i) {
-    free(points[i]);
+  if (threaded) {
+    atomic_store(&worker.stop, true);
+    pthread_join(thread, NULL);
+    free_snapshots(&snapshots);
   }
-  free(heights);
-  free(points);
-  free_erode(&erosion);
-  free2DArray(map);
-  free2DArray(tempMap);
-  free2DArray(heightMap);
-  free(m);
+  free_colorizer(&colorizer);
+  free_generator(&generator);
   return 0;
 }
@@ -348,6 +348,151 @@ double open_simplex_noise2(const struct osn_context *ctx, double x, double y)
 	return value / NORM_CONSTANT_2D;
 }
 	
+/*
+ * Gradient index of a 2D lattice vertex.  With a cache, the indices of the
+ * 4x4 vertices around the current super-cell are looked up once and reused
+ * until the evaluation point moves to another cell.
+ */
+static INLINE int gradIndex2(const struct osn_context *ctx, const struct osn_lattice_cache2 *cache, int xsv, int ysv)
+{
+	const int16_t *perm = ctx->perm;
+
+	if (cache)
+		return cache->index[(ysv - cache->ysb + 1) * 4 + (xsv - cache->xsb + 1)];
+	return perm[(perm[xsv & 0xFF] + ysv) & 0xFF] & 0x0E;
+}
+
+static void fill_lattice_cache2(const struct osn_context *ctx, struct osn_lattice_cache2 *cache, int xsb, int ysb)
+{
+	int i, j;
+
+	for (j = 0; j < 4; j++)
+		for (i = 0; i < 4; i++)
+			cache->index[j * 4 + i] = (int8_t) gradIndex2(ctx, NULL, xsb + i - 1, ysb + j - 1);
+	cache->xsb = xsb;
+	cache->ysb = ysb;
+	cache->valid = 1;
+}
+
+/*
+ * Adds the contribution of one 2D lattice vertex to value and its analytic
+ * gradient.  With attn = 2 - dx^2 - dy^2 the contribution is attn^4 * (g . d),
+ * so its gradient is attn^4 * g - 8 * attn^3 * (g . d) * d.
+ */
+static INLINE void contribute2_deriv(const struct osn_context *ctx, const struct osn_lattice_cache2 *cache,
+	int xsb, int ysb, double dx, double dy, double *value, double *dvdx, double *dvdy)
+{
+	int index;
+	double attn, attn2, attn3, ext;
+
+	attn = 2 - dx * dx - dy * dy;
+	if (attn <= 0)
+		return;
+	index = gradIndex2(ctx, cache, xsb, ysb);
+	ext = gradients2D[index] * dx + gradients2D[index + 1] * dy;
+	attn2 = attn * attn;
+	attn3 = attn2 * attn;
+	*value += attn2 * attn2 * ext;
+	*dvdx += attn2 * attn2 * gradients2D[index] - 8 * attn3 * ext * dx;
+	*dvdy += attn2 * attn2 * gradients2D[index + 1] - 8 * attn3 * ext * dy;
+}
+
+static INLINE double noise2_deriv(const struct osn_context *ctx, struct osn_lattice_cache2 *cache,
+	double x, double y, double *dvdx, double *dvdy)
+{
+	double stretchOffset = (x + y) * STRETCH_CONSTANT_2D;
+	double xs = x + stretchOffset;
+	double ys = y + stretchOffset;
+	int xsb = fastFloor(xs);
+	int ysb = fastFloor(ys);
+	double squishOffset = (xsb + ysb) * SQUISH_CONSTANT_2D;
+	double xins = xs - xsb;
+	double yins = ys - ysb;
+	double inSum = xins + yins;
+	double dx0 = x - (xsb + squishOffset);
+	double dy0 = y - (ysb + squishOffset);
+	double dx_ext, dy_ext;
+	int xsv_ext, ysv_ext;
+	double zins;
+	double value = 0, gx = 0, gy = 0;
+
+	if (cache && (!cache->valid || cache->xsb != xsb || cache->ysb != ysb))
+		fill_lattice_cache2(ctx, cache, xsb, ysb);
+
+	/* Contributions (1,0) and (0,1) */
+	contribute2_deriv(ctx, cache, xsb + 1, ysb + 0, dx0 - 1 - SQUISH_CONSTANT_2D, dy0 - 0 - SQUISH_CONSTANT_2D, &value, &gx, &gy);
+	contribute2_deriv(ctx, cache, xsb + 0, ysb + 1, dx0 - 0 - SQUISH_CONSTANT_2D, dy0 - 1 - SQUISH_CONSTANT_2D, &value, &gx, &gy);
+
+	if (inSum <= 1) {
+		zins = 1 - inSum;
+		if (zins > xins || zins > yins) {
+			if (xins > yins) {
+				xsv_ext = xsb + 1;
+				ysv_ext = ysb - 1;
+				dx_ext = dx0 - 1;
+				dy_ext = dy0 + 1;
+			} else {
+				xsv_ext = xsb - 1;
+				ysv_ext = ysb + 1;
+				dx_ext = dx0 + 1;
+				dy_ext = dy0 - 1;
+			}
+		} else {
+			xsv_ext = xsb + 1;
+			ysv_ext = ysb + 1;
+			dx_ext = dx0 - 1 - 2 * SQUISH_CONSTANT_2D;
+			dy_ext = dy0 - 1 - 2 * SQUISH_CONSTANT_2D;
+		}
+	} else {
+		zins = 2 - inSum;
+		if (zins < xins || zins < yins) {
+			if (xins > yins) {
+				xsv_ext = xsb + 2;
+				ysv_ext = ysb + 0;
+				dx_ext = dx0 - 2 - 2 * SQUISH_CONSTANT_2D;
+				dy_ext = dy0 + 0 - 2 * SQUISH_CONSTANT_2D;
+			} else {
+				xsv_ext = xsb + 0;
+				ysv_ext = ysb + 2;
+				dx_ext = dx0 + 0 - 2 * SQUISH_CONSTANT_2D;
+				dy_ext = dy0 - 2 - 2 * SQUISH_CONSTANT_2D;
+			}
+		} else {
+			dx_ext = dx0;
+			dy_ext = dy0;
+			xsv_ext = xsb;
+			ysv_ext = ysb;
+		}
+		xsb += 1;
+		ysb += 1;
+		dx0 = dx0 - 1 - 2 * SQUISH_CONSTANT_2D;
+		dy0 = dy0 - 1 - 2 * SQUISH_CONSTANT_2D;
+	}
+
+	/* Contribution (0,0) or (1,1), then the extra vertex */
+	contribute2_deriv(ctx, cache, xsb, ysb, dx0, dy0, &value, &gx, &gy);
+	contribute2_deriv(ctx, cache, xsv_ext, ysv_ext, dx_ext, dy_ext, &value, &gx, &gy);
+
+	*dvdx = gx / NORM_CONSTANT_2D;
+	*dvdy = gy / NORM_CONSTANT_2D;
+	return value / NORM_CONSTANT_2D;
+}
+
+/*
+ * 2D OpenSimplex noise together with its exact gradient.  Walks the same
+ * lattice vertices as open_simplex_noise2, so the returned value matches it.
+ */
+double open_simplex_noise2_deriv(const struct osn_context *ctx, double x, double y, double *dvdx, double *dvdy)
+{
+	return noise2_deriv(ctx, NULL, x, y, dvdx, dvdy);
+}
+
+double open_simplex_noise2_deriv_cached(const struct osn_context *ctx, struct osn_lattice_cache2 *cache,
+	double x, double y, double *dvdx, double *dvdy)
+{
+	return noise2_deriv(ctx, cache, x, y, dvdx, dvdy);
+}
+
 /*
  * 3D OpenSimplex (Simplectic) Noise
  */
@@ -2249,3 +2394,302 @@ double open_simplex_noise4(const struct osn_context *ctx, double x, double y, do
 	return value / NORM_CONSTANT_4D;
 }
 	
+
+/*
+ * Batched evaluation.
+ *
+ * Rather than walking the region selection logic of the scalar functions, the
+ * SIMD kernels below sum the contribution of every lattice vertex that can lie
+ * inside the kernel radius of a point.  Relative to the super-cell origin
+ * (xsb, ysb[, zsb]) that is a fixed set of 8 vertices in 2D and 26 in 3D, so
+ * all lanes run the same instruction stream and out-of-range vertices simply
+ * get a zero attenuation.
+ */
+
+static const int8_t batchVertices2D[][2] = {
+	{ 0,  0}, { 1,  0}, { 0,  1}, { 1,  1},
+	{ 2,  0}, { 0,  2}, { 1, -1}, {-1,  1},
+};
+
+static const int8_t batchVertices3D[][3] = {
+	{ 0,  0,  0}, { 1,  0,  0}, { 0,  1,  0}, { 0,  0,  1},
+	{ 1,  1,  0}, { 1,  0,  1}, { 0,  1,  1}, { 1,  1,  1},
+	{ 2,  0,  0}, { 0,  2,  0}, { 0,  0,  2}, { 2,  1,  0},
+	{ 2,  0,  1}, { 1,  2,  0}, { 0,  2,  1}, { 1,  0,  2},
+	{ 0,  1,  2}, { 1, -1,  0}, { 1,  0, -1}, {-1,  1,  0},
+	{ 0,  1, -1}, {-1,  0,  1}, { 0, -1,  1}, { 1,  1, -1},
+	{ 1, -1,  1}, {-1,  1,  1},
+};
+
+#define BATCH_VERTICES_2D ((int) ARRAYSIZE(batchVertices2D))
+#define BATCH_VERTICES_3D ((int) ARRAYSIZE(batchVertices3D))
+
+/* Lookup tables widened to 32 bits so they can be gathered. */
+struct osn_batch_tables {
+	int32_t perm[256];
+	int32_t gradIndex3D[256];
+	float grad2X[8], grad2Y[8];
+	float grad3X[24], grad3Y[24], grad3Z[24];
+};
+
+static void batch_tables_init(const struct osn_context *ctx, struct osn_batch_tables *t)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		t->perm[i] = ctx->perm[i];
+		t->gradIndex3D[i] = ctx->permGradIndex3D[i] / 3;
+	}
+	for (i = 0; i < 8; i++) {
+		t->grad2X[i] = gradients2D[i * 2];
+		t->grad2Y[i] = gradients2D[i * 2 + 1];
+	}
+	for (i = 0; i < 24; i++) {
+		t->grad3X[i] = gradients3D[i * 3];
+		t->grad3Y[i] = gradients3D[i * 3 + 1];
+		t->grad3Z[i] = gradients3D[i * 3 + 2];
+	}
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define OSN_BATCH_SIMD 1
+#include <immintrin.h>
+#include <pthread.h>
+#endif
+
+#ifdef OSN_BATCH_SIMD
+
+/* SSE2 has no floor instruction, so truncate and correct negative values. */
+static INLINE __m128 sse2_floor(__m128 v)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+}
+
+static void noise2_sse2(const struct osn_batch_tables *t, const float *x, const float *y, float *out)
+{
+	__m128 vx = _mm_loadu_ps(x), vy = _mm_loadu_ps(y);
+	__m128 stretch = _mm_mul_ps(_mm_add_ps(vx, vy), _mm_set1_ps((float) STRETCH_CONSTANT_2D));
+	__m128 xs = _mm_add_ps(vx, stretch), ys = _mm_add_ps(vy, stretch);
+	__m128 xsb = sse2_floor(xs), ysb = sse2_floor(ys);
+	__m128 xins = _mm_sub_ps(xs, xsb), yins = _mm_sub_ps(ys, ysb);
+	__m128 squish = _mm_mul_ps(_mm_add_ps(xins, yins), _mm_set1_ps((float) SQUISH_CONSTANT_2D));
+	__m128 dx0 = _mm_add_ps(xins, squish), dy0 = _mm_add_ps(yins, squish);
+	__m128 value = _mm_setzero_ps();
+	int32_t bx[4], by[4];
+	float gx[4], gy[4];
+	int v, l;
+
+	_mm_storeu_si128((__m128i *) bx, _mm_cvtps_epi32(xsb));
+	_mm_storeu_si128((__m128i *) by, _mm_cvtps_epi32(ysb));
+	for (v = 0; v < BATCH_VERTICES_2D; v++) {
+		int i = batchVertices2D[v][0], j = batchVertices2D[v][1];
+		float s = (float) ((i + j) * SQUISH_CONSTANT_2D);
+		__m128 dx = _mm_sub_ps(dx0, _mm_set1_ps(i + s));
+		__m128 dy = _mm_sub_ps(dy0, _mm_set1_ps(j + s));
+		__m128 attn = _mm_sub_ps(_mm_set1_ps(2.0f),
+			_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+		attn = _mm_max_ps(attn, _mm_setzero_ps());
+		attn = _mm_mul_ps(attn, attn);
+		attn = _mm_mul_ps(attn, attn);
+		for (l = 0; l < 4; l++) {
+			int g = t->perm[(t->perm[(bx[l] + i) & 0xFF] + by[l] + j) & 0xFF] & 0x0E;
+			gx[l] = t->grad2X[g >> 1];
+			gy[l] = t->grad2Y[g >> 1];
+		}
+		value = _mm_add_ps(value, _mm_mul_ps(attn,
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gx), dx), _mm_mul_ps(_mm_loadu_ps(gy), dy))));
+	}
+	_mm_storeu_ps(out, _mm_mul_ps(value, _mm_set1_ps((float) (1.0 / NORM_CONSTANT_2D))));
+}
+
+static void noise3_sse2(const struct osn_batch_tables *t, const float *x, const float *y, const float *z, float *out)
+{
+	__m128 vx = _mm_loadu_ps(x), vy = _mm_loadu_ps(y), vz = _mm_loadu_ps(z);
+	__m128 stretch = _mm_mul_ps(_mm_add_ps(_mm_add_ps(vx, vy), vz), _mm_set1_ps((float) STRETCH_CONSTANT_3D));
+	__m128 xs = _mm_add_ps(vx, stretch), ys = _mm_add_ps(vy, stretch), zs = _mm_add_ps(vz, stretch);
+	__m128 xsb = sse2_floor(xs), ysb = sse2_floor(ys), zsb = sse2_floor(zs);
+	__m128 xins = _mm_sub_ps(xs, xsb), yins = _mm_sub_ps(ys, ysb), zins = _mm_sub_ps(zs, zsb);
+	__m128 squish = _mm_mul_ps(_mm_add_ps(_mm_add_ps(xins, yins), zins), _mm_set1_ps((float) SQUISH_CONSTANT_3D));
+	__m128 dx0 = _mm_add_ps(xins, squish), dy0 = _mm_add_ps(yins, squish), dz0 = _mm_add_ps(zins, squish);
+	__m128 value = _mm_setzero_ps();
+	int32_t bx[4], by[4], bz[4];
+	float gx[4], gy[4], gz[4];
+	int v, l;
+
+	_mm_storeu_si128((__m128i *) bx, _mm_cvtps_epi32(xsb));
+	_mm_storeu_si128((__m128i *) by, _mm_cvtps_epi32(ysb));
+	_mm_storeu_si128((__m128i *) bz, _mm_cvtps_epi32(zsb));
+	for (v = 0; v < BATCH_VERTICES_3D; v++) {
+		int i = batchVertices3D[v][0], j = batchVertices3D[v][1], k = batchVertices3D[v][2];
+		float s = (float) ((i + j + k) * SQUISH_CONSTANT_3D);
+		__m128 dx = _mm_sub_ps(dx0, _mm_set1_ps(i + s));
+		__m128 dy = _mm_sub_ps(dy0, _mm_set1_ps(j + s));
+		__m128 dz = _mm_sub_ps(dz0, _mm_set1_ps(k + s));
+		__m128 attn = _mm_sub_ps(_mm_set1_ps(2.0f), _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		attn = _mm_max_ps(attn, _mm_setzero_ps());
+		attn = _mm_mul_ps(attn, attn);
+		attn = _mm_mul_ps(attn, attn);
+		for (l = 0; l < 4; l++) {
+			int g = t->gradIndex3D[(t->perm[(t->perm[(bx[l] + i) & 0xFF] + by[l] + j) & 0xFF] + bz[l] + k) & 0xFF];
+			gx[l] = t->grad3X[g];
+			gy[l] = t->grad3Y[g];
+			gz[l] = t->grad3Z[g];
+		}
+		value = _mm_add_ps(value, _mm_mul_ps(attn, _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_loadu_ps(gx), dx), _mm_mul_ps(_mm_loadu_ps(gy), dy)),
+			_mm_mul_ps(_mm_loadu_ps(gz), dz))));
+	}
+	_mm_storeu_ps(out, _mm_mul_ps(value, _mm_set1_ps((float) (1.0 / NORM_CONSTANT_3D))));
+}
+
+__attribute__((target("avx2,fma")))
+static void noise2_avx2(const struct osn_batch_tables *t, const float *x, const float *y, float *out)
+{
+	__m256 vx = _mm256_loadu_ps(x), vy = _mm256_loadu_ps(y);
+	__m256 stretch = _mm256_mul_ps(_mm256_add_ps(vx, vy), _mm256_set1_ps((float) STRETCH_CONSTANT_2D));
+	__m256 xs = _mm256_add_ps(vx, stretch), ys = _mm256_add_ps(vy, stretch);
+	__m256 xsb = _mm256_floor_ps(xs), ysb = _mm256_floor_ps(ys);
+	__m256 xins = _mm256_sub_ps(xs, xsb), yins = _mm256_sub_ps(ys, ysb);
+	__m256 squish = _mm256_mul_ps(_mm256_add_ps(xins, yins), _mm256_set1_ps((float) SQUISH_CONSTANT_2D));
+	__m256 dx0 = _mm256_add_ps(xins, squish), dy0 = _mm256_add_ps(yins, squish);
+	__m256i bx = _mm256_cvtps_epi32(xsb), by = _mm256_cvtps_epi32(ysb);
+	__m256i mask = _mm256_set1_epi32(0xFF);
+	__m256 gradX = _mm256_loadu_ps(t->grad2X), gradY = _mm256_loadu_ps(t->grad2Y);
+	__m256 value = _mm256_setzero_ps();
+	int v;
+
+	for (v = 0; v < BATCH_VERTICES_2D; v++) {
+		int i = batchVertices2D[v][0], j = batchVertices2D[v][1];
+		float s = (float) ((i + j) * SQUISH_CONSTANT_2D);
+		__m256 dx = _mm256_sub_ps(dx0, _mm256_set1_ps(i + s));
+		__m256 dy = _mm256_sub_ps(dy0, _mm256_set1_ps(j + s));
+		__m256 attn = _mm256_fnmadd_ps(dy, dy, _mm256_fnmadd_ps(dx, dx, _mm256_set1_ps(2.0f)));
+		__m256i h;
+		attn = _mm256_max_ps(attn, _mm256_setzero_ps());
+		attn = _mm256_mul_ps(attn, attn);
+		attn = _mm256_mul_ps(attn, attn);
+		h = _mm256_i32gather_epi32(t->perm, _mm256_and_si256(_mm256_add_epi32(bx, _mm256_set1_epi32(i)), mask), 4);
+		h = _mm256_add_epi32(h, _mm256_add_epi32(by, _mm256_set1_epi32(j)));
+		h = _mm256_i32gather_epi32(t->perm, _mm256_and_si256(h, mask), 4);
+		h = _mm256_srli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(0x0E)), 1);
+		value = _mm256_fmadd_ps(attn, _mm256_fmadd_ps(_mm256_permutevar8x32_ps(gradX, h), dx,
+			_mm256_mul_ps(_mm256_permutevar8x32_ps(gradY, h), dy)), value);
+	}
+	_mm256_storeu_ps(out, _mm256_mul_ps(value, _mm256_set1_ps((float) (1.0 / NORM_CONSTANT_2D))));
+}
+
+__attribute__((target("avx2,fma")))
+static void noise3_avx2(const struct osn_batch_tables *t, const float *x, const float *y, const float *z, float *out)
+{
+	__m256 vx = _mm256_loadu_ps(x), vy = _mm256_loadu_ps(y), vz = _mm256_loadu_ps(z);
+	__m256 stretch = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(vx, vy), vz), _mm256_set1_ps((float) STRETCH_CONSTANT_3D));
+	__m256 xs = _mm256_add_ps(vx, stretch), ys = _mm256_add_ps(vy, stretch), zs = _mm256_add_ps(vz, stretch);
+	__m256 xsb = _mm256_floor_ps(xs), ysb = _mm256_floor_ps(ys), zsb = _mm256_floor_ps(zs);
+	__m256 xins = _mm256_sub_ps(xs, xsb), yins = _mm256_sub_ps(ys, ysb), zins = _mm256_sub_ps(zs, zsb);
+	__m256 squish = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(xins, yins), zins), _mm256_set1_ps((float) SQUISH_CONSTANT_3D));
+	__m256 dx0 = _mm256_add_ps(xins, squish), dy0 = _mm256_add_ps(yins, squish), dz0 = _mm256_add_ps(zins, squish);
+	__m256i bx = _mm256_cvtps_epi32(xsb), by = _mm256_cvtps_epi32(ysb), bz = _mm256_cvtps_epi32(zsb);
+	__m256i mask = _mm256_set1_epi32(0xFF);
+	__m256 value = _mm256_setzero_ps();
+	int v;
+
+	for (v = 0; v < BATCH_VERTICES_3D; v++) {
+		int i = batchVertices3D[v][0], j = batchVertices3D[v][1], k = batchVertices3D[v][2];
+		float s = (float) ((i + j + k) * SQUISH_CONSTANT_3D);
+		__m256 dx = _mm256_sub_ps(dx0, _mm256_set1_ps(i + s));
+		__m256 dy = _mm256_sub_ps(dy0, _mm256_set1_ps(j + s));
+		__m256 dz = _mm256_sub_ps(dz0, _mm256_set1_ps(k + s));
+		__m256 attn = _mm256_fnmadd_ps(dz, dz, _mm256_fnmadd_ps(dy, dy, _mm256_fnmadd_ps(dx, dx, _mm256_set1_ps(2.0f))));
+		__m256i h;
+		attn = _mm256_max_ps(attn, _mm256_setzero_ps());
+		attn = _mm256_mul_ps(attn, attn);
+		attn = _mm256_mul_ps(attn, attn);
+		h = _mm256_i32gather_epi32(t->perm, _mm256_and_si256(_mm256_add_epi32(bx, _mm256_set1_epi32(i)), mask), 4);
+		h = _mm256_add_epi32(h, _mm256_add_epi32(by, _mm256_set1_epi32(j)));
+		h = _mm256_i32gather_epi32(t->perm, _mm256_and_si256(h, mask), 4);
+		h = _mm256_add_epi32(h, _mm256_add_epi32(bz, _mm256_set1_epi32(k)));
+		h = _mm256_i32gather_epi32(t->gradIndex3D, _mm256_and_si256(h, mask), 4);
+		value = _mm256_fmadd_ps(attn, _mm256_fmadd_ps(_mm256_i32gather_ps(t->grad3X, h, 4), dx,
+			_mm256_fmadd_ps(_mm256_i32gather_ps(t->grad3Y, h, 4), dy,
+			_mm256_mul_ps(_mm256_i32gather_ps(t->grad3Z, h, 4), dz))), value);
+	}
+	_mm256_storeu_ps(out, _mm256_mul_ps(value, _mm256_set1_ps((float) (1.0 / NORM_CONSTANT_3D))));
+}
+
+typedef void (*noise2_kernel)(const struct osn_batch_tables *, const float *, const float *, float *);
+typedef void (*noise3_kernel)(const struct osn_batch_tables *, const float *, const float *, const float *, float *);
+
+static int cpu_lanes = 4;
+static pthread_once_t lanes_detected = PTHREAD_ONCE_INIT;
+
+static void detect_lanes(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		cpu_lanes = 8;
+}
+
+/* Detected once, as the batch functions are called from several threads. */
+static int batch_lanes(void)
+{
+	pthread_once(&lanes_detected, detect_lanes);
+	return cpu_lanes;
+}
+
+#endif /* OSN_BATCH_SIMD */
+
+void open_simplex_noise2_batch(const struct osn_context *ctx, const float *xs, const float *ys, float *out, size_t n)
+{
+	size_t i = 0;
+#ifdef OSN_BATCH_SIMD
+	struct osn_batch_tables t;
+	int lanes = batch_lanes();
+	noise2_kernel kernel = lanes == 8 ? noise2_avx2 : noise2_sse2;
+	float px[8] = {0}, py[8] = {0}, po[8];
+
+	if (n >= (size_t) lanes) {
+		batch_tables_init(ctx, &t);
+		for (; i + lanes <= n; i += lanes)
+			kernel(&t, xs + i, ys + i, out + i);
+		/* Pad the tail so the kernel never reads past the caller's arrays. */
+		if (i < n) {
+			memcpy(px, xs + i, (n - i) * sizeof(float));
+			memcpy(py, ys + i, (n - i) * sizeof(float));
+			kernel(&t, px, py, po);
+			memcpy(out + i, po, (n - i) * sizeof(float));
+			i = n;
+		}
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = (float) open_simplex_noise2(ctx, xs[i], ys[i]);
+}
+
+void open_simplex_noise3_batch(const struct osn_context *ctx, const float *xs, const float *ys, const float *zs, float *out, size_t n)
+{
+	size_t i = 0;
+#ifdef OSN_BATCH_SIMD
+	struct osn_batch_tables t;
+	int lanes = batch_lanes();
+	noise3_kernel kernel = lanes == 8 ? noise3_avx2 : noise3_sse2;
+	float px[8] = {0}, py[8] = {0}, pz[8] = {0}, po[8];
+
+	if (n >= (size_t) lanes) {
+		batch_tables_init(ctx, &t);
+		for (; i + lanes <= n; i += lanes)
+			kernel(&t, xs + i, ys + i, zs + i, out + i);
+		if (i < n) {
+			memcpy(px, xs + i, (n - i) * sizeof(float));
+			memcpy(py, ys + i, (n - i) * sizeof(float));
+			memcpy(pz, zs + i, (n - i) * sizeof(float));
+			kernel(&t, px, py, pz, po);
+			memcpy(out + i, po, (n - i) * sizeof(float));
+			i = n;
+		}
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = (float) open_simplex_noise3(ctx, xs[i], ys[i], zs[i]);
+}
@@ -31,12 +31,26 @@
 	#define INLINE
 #endif
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 	extern "C" {
 #endif
 
 struct osn_context;
 
+/*
+ * Gradient indices of the vertices around one 2D super-cell.  Callers that
+ * evaluate many nearby points in order (e.g. along a row) can keep one of
+ * these per noise layer to skip the permutation lookups while the points stay
+ * in the same cell.  Zero-initialize before first use.
+ */
+struct osn_lattice_cache2 {
+	int xsb, ysb;
+	int valid;
+	int8_t index[16];
+};
+
 int open_simplex_noise(int64_t seed, struct osn_context **ctx);
 void open_simplex_noise_free(struct osn_context *ctx);
 int open_simplex_noise_init_perm(struct osn_context *ctx, int16_t p[], int nelements);
@@ -44,6 +58,25 @@ double open_simplex_noise2(const struct osn_context *ctx, double x, double y);
 double open_simplex_noise3(const struct osn_context *ctx, double x, double y, double z);
 double open_simplex_noise4(const struct osn_context *ctx, double x, double y, double z, double w);
 
+/* 2D noise value plus its analytic partial derivatives in x and y. */
+double open_simplex_noise2_deriv(const struct osn_context *ctx, double x, double y, double *dvdx, double *dvdy);
+double open_simplex_noise2_deriv_cached(const struct osn_context *ctx, struct osn_lattice_cache2 *cache,
+	double x, double y, double *dvdx, double *dvdy);
+
+/*
+ * Batched single precision evaluation: out[i] = noise(xs[i], ys[i] [, zs[i]]).
+ * An AVX2 or SSE2 kernel is picked at runtime, with the scalar functions above
+ * as the fallback.  The SIMD kernels work in float, so results agree with the
+ * scalar functions to within OSN_BATCH_TOLERANCE for coordinates of magnitude
+ * up to 1024; beyond that the error grows with the float spacing of the input.
+ * The 3D kernel sums every lattice vertex in range, which also differs from the
+ * scalar region selection by up to ~1e-4 in a few places.
+ */
+#define OSN_BATCH_TOLERANCE (5e-4)
+
+void open_simplex_noise2_batch(const struct osn_context *ctx, const float *xs, const float *ys, float *out, size_t n);
+void open_simplex_noise3_batch(const struct osn_context *ctx, const float *xs, const float *ys, const float *zs, float *out, size_t n);
+
 #ifdef __cplusplus
 	}
 #endif
@@ -0,0 +1,127 @@
+#include "parallel.h"
+#include <pthread.h>
+#include <unistd.h>
+
+// One parallelFor call. Its bands are claimed in order by whichever thread
+// gets to them first, the caller included, so a call never waits on a pool
+// that is busy with someone else's work.
+typedef struct Batch {
+  ParallelTask task;
+  void *arg;
+  size_t count;
+  size_t nBands;
+  size_t claimed;
+  size_t finished;
+  pthread_cond_t done;
+  struct Batch *next;
+} Batch;
+
+// The workers are started on demand and live for the rest of the process,
+// waiting on poolWork for batches with unclaimed bands.
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWork = PTHREAD_COND_INITIALIZER;
+static Batch *queue;
+static size_t nWorkers;
+
+// Takes the next band of a queued batch, unqueueing it once the last band is
+// taken. Called with poolLock held.
+static size_t claimBand(Batch *batch) {
+  size_t band = batch->claimed++;
+  if (batch->claimed == batch->nBands) {
+    Batch **link = &queue;
+    while (*link != batch)
+      link = &(*link)->next;
+    *link = batch->next;
+  }
+  return band;
+}
+
+// Runs a claimed band with poolLock released. The batch must not be touched
+// after the last band reports in, as its caller may return straight away.
+static void runBand(Batch *batch, size_t band) {
+  pthread_mutex_unlock(&poolLock);
+  batch->task(batch->arg, batch->count * band / batch->nBands,
+              batch->count * (band + 1) / batch->nBands);
+  pthread_mutex_lock(&poolLock);
+  if (++batch->finished == batch->nBands)
+    pthread_cond_signal(&batch->done);
+}
+
+static void *poolWorker(void *unused) {
+  (void)unused;
+  pthread_mutex_lock(&poolLock);
+  for (;;) {
+    while (queue == NULL)
+      pthread_cond_wait(&poolWork, &poolLock);
+    Batch *batch = queue;
+    runBand(batch, claimBand(batch));
+  }
+  return NULL;
+}
+
+// Starts workers until there are at least wanted. Called with poolLock held;
+// if a thread cannot be started its bands are left to the callers.
+static void growPool(size_t wanted) {
+  while (nWorkers < wanted) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, poolWorker, NULL) != 0)
+      return;
+    pthread_detach(thread);
+    ++nWorkers;
+  }
+}
+
+size_t threadCount(size_t requested) {
+  if (requested > 0)
+    return requested;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  return online > 0 ? (size_t)online : 1;
+}
+
+static bool avx2;
+static pthread_once_t avx2Detected = PTHREAD_ONCE_INIT;
+
+static void detectAVX2() {
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool haveAVX2() {
+  pthread_once(&avx2Detected, detectAVX2);
+  return avx2;
+}
+
+// Splits [0, count) into nThreads contiguous bands and runs task on each,
+// with the calling thread taking the first band and the pool's workers the
+// rest. The split only depends on count and nThreads, so results are
+// reproducible for a given thread count.
+void parallelFor(size_t count, size_t nThreads, ParallelTask task, void *arg) {
+  nThreads = threadCount(nThreads);
+  if (nThreads > count)
+    nThreads = count;
+  if (nThreads <= 1) {
+    task(arg, 0, count);
+    return;
+  }
+
+  Batch batch = {.task = task, .arg = arg, .count = count, .nBands = nThreads};
+  pthread_cond_init(&batch.done, NULL);
+  pthread_mutex_lock(&poolLock);
+  growPool(nThreads - 1);
+  Batch **tail = &queue;
+  while (*tail != NULL)
+    tail = &(*tail)->next;
+  *tail = &batch;
+  pthread_cond_broadcast(&poolWork);
+  // The caller works through its own bands too, starting with the first, so
+  // the call finishes even when every worker is busy or nested inside it.
+  while (batch.claimed < batch.nBands)
+    runBand(&batch, claimBand(&batch));
+  while (batch.finished < batch.nBands)
+    pthread_cond_wait(&batch.done, &poolLock);
+  pthread_mutex_unlock(&poolLock);
+  pthread_cond_destroy(&batch.done);
+}
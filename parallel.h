@@ -0,0 +1,12 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*ParallelTask)(void *arg, size_t begin, size_t end);
+
+size_t threadCount(size_t requested);
+void parallelFor(size_t count, size_t nThreads, ParallelTask task, void *arg);
+
+// Whether the CPU runs AVX2. Detected once per process, so any thread may
+// ask at any time.
+bool haveAVX2();
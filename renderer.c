@@ -0,0 +1,179 @@
+#include "renderer.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Buffer objects are GL 1.5 and pixel unpack buffers GL 2.1, past what
+// libGL exports everywhere, so they are looked up at runtime.
+static PFNGLGENBUFFERSPROC genBuffers;
+static PFNGLDELETEBUFFERSPROC deleteBuffers;
+static PFNGLBINDBUFFERPROC bindBuffer;
+static PFNGLBUFFERDATAPROC bufferData;
+static PFNGLMAPBUFFERPROC mapBuffer;
+static PFNGLUNMAPBUFFERPROC unmapBuffer;
+
+static bool loadBufferFunctions() {
+  if (!glfwExtensionSupported("GL_ARB_pixel_buffer_object"))
+    return false;
+  genBuffers = (PFNGLGENBUFFERSPROC)glfwGetProcAddress("glGenBuffers");
+  deleteBuffers =
+      (PFNGLDELETEBUFFERSPROC)glfwGetProcAddress("glDeleteBuffers");
+  bindBuffer = (PFNGLBINDBUFFERPROC)glfwGetProcAddress("glBindBuffer");
+  bufferData = (PFNGLBUFFERDATAPROC)glfwGetProcAddress("glBufferData");
+  mapBuffer = (PFNGLMAPBUFFERPROC)glfwGetProcAddress("glMapBuffer");
+  unmapBuffer = (PFNGLUNMAPBUFFERPROC)glfwGetProcAddress("glUnmapBuffer");
+  return genBuffers && deleteBuffers && bindBuffer && bufferData &&
+         mapBuffer && unmapBuffer;
+}
+
+static size_t imageBytes(const Renderer *renderer) {
+  return (size_t)renderer->imageWidth * renderer->imageHeight * 4;
+}
+
+void renderer_init(Renderer *renderer, const char *mode, int width,
+                   int height, int imageWidth, int imageHeight) {
+  renderer->width = width;
+  renderer->height = height;
+  renderer->imageWidth = imageWidth;
+  renderer->imageHeight = imageHeight;
+  renderer->texture = 0;
+  renderer->nextPbo = 0;
+  if (strcmp(mode, "points") == 0) {
+    renderer->mode = RENDER_POINTS;
+    return;
+  }
+  renderer->mode = strcmp(mode, "pbo") == 0 ? RENDER_PBO : RENDER_TEXTURE;
+
+  GLint maxSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+  if (imageWidth > maxSize || imageHeight > maxSize) {
+    fprintf(stderr, "%dx%d is over the %d texture size limit, drawing "
+                    "points instead.\n",
+            imageWidth, imageHeight, maxSize);
+    renderer->mode = RENDER_POINTS;
+    return;
+  }
+  glGenTextures(1, &renderer->texture);
+  glBindTexture(GL_TEXTURE_2D, renderer->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, imageWidth, imageHeight, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  if (glGetError() != GL_NO_ERROR) {
+    fprintf(stderr, "Failed to create a %dx%d texture, drawing points "
+                    "instead.\n",
+            imageWidth, imageHeight);
+    glDeleteTextures(1, &renderer->texture);
+    renderer->texture = 0;
+    renderer->mode = RENDER_POINTS;
+    return;
+  }
+
+  if (renderer->mode == RENDER_PBO) {
+    if (!loadBufferFunctions()) {
+      fprintf(stderr, "No pixel buffer objects, uploading textures "
+                      "directly.\n");
+      renderer->mode = RENDER_TEXTURE;
+      return;
+    }
+    genBuffers(2, renderer->pbos);
+    for (int i = 0; i < 2; ++i) {
+      bindBuffer(GL_PIXEL_UNPACK_BUFFER, renderer->pbos[i]);
+      bufferData(GL_PIXEL_UNPACK_BUFFER, imageBytes(renderer), NULL,
+                 GL_STREAM_DRAW);
+    }
+    bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+}
+
+void free_renderer(Renderer *renderer) {
+  if (renderer->mode == RENDER_PBO)
+    deleteBuffers(2, renderer->pbos);
+  if (renderer->texture != 0)
+    glDeleteTextures(1, &renderer->texture);
+  renderer->texture = 0;
+}
+
+const char *rendererName(const Renderer *renderer) {
+  switch (renderer->mode) {
+  case RENDER_POINTS:
+    return "points";
+  case RENDER_TEXTURE:
+    return "texture";
+  default:
+    return "pbo";
+  }
+}
+
+static void drawPoints(const Renderer *renderer, const Colorizer *colorizer) {
+  const int width = renderer->width, height = renderer->height;
+  glBegin(GL_POINTS);
+  for (int y = 0; y < height; ++y) {
+    const uint32_t *row =
+        colorizer->pixels +
+        (size_t)((int64_t)y * colorizer->height / height) * colorizer->width;
+    for (int x = 0; x < width; ++x) {
+      const uint8_t *rgba =
+          (const uint8_t *)&row[(int64_t)x * colorizer->width / width];
+      glColor3ub(rgba[0], rgba[1], rgba[2]);
+      glVertex2i(x, y);
+    }
+  }
+  glEnd();
+}
+
+// Writes the image into the next of the two buffers, orphaning its old
+// storage so the write never waits on a transfer still reading it, and
+// starts the texture upload from it.
+static void uploadThroughPbo(Renderer *renderer, const Colorizer *colorizer) {
+  const size_t bytes = imageBytes(renderer);
+  bindBuffer(GL_PIXEL_UNPACK_BUFFER, renderer->pbos[renderer->nextPbo]);
+  renderer->nextPbo ^= 1;
+  bufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+  void *mapped = mapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+  if (mapped != NULL) {
+    memcpy(mapped, colorizer->pixels, bytes);
+    unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, renderer->imageWidth,
+                    renderer->imageHeight, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  }
+  bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Row 0 of the image is the bottom of the window, as with the points.
+static void drawQuad(const Renderer *renderer) {
+  glEnable(GL_TEXTURE_2D);
+  glColor3ub(255, 255, 255);
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 0);
+  glVertex2i(0, 0);
+  glTexCoord2f(1, 0);
+  glVertex2i(renderer->width, 0);
+  glTexCoord2f(1, 1);
+  glVertex2i(renderer->width, renderer->height);
+  glTexCoord2f(0, 1);
+  glVertex2i(0, renderer->height);
+  glEnd();
+  glDisable(GL_TEXTURE_2D);
+}
+
+void renderFrame(Renderer *renderer, const Colorizer *colorizer,
+                 bool changed) {
+  glClear(GL_COLOR_BUFFER_BIT);
+  if (renderer->mode == RENDER_POINTS) {
+    drawPoints(renderer, colorizer);
+    return;
+  }
+  glBindTexture(GL_TEXTURE_2D, renderer->texture);
+  if (changed && renderer->mode == RENDER_PBO) {
+    uploadThroughPbo(renderer, colorizer);
+  } else if (changed) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, renderer->imageWidth,
+                    renderer->imageHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                    colorizer->pixels);
+  }
+  drawQuad(renderer);
+}
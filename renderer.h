@@ -0,0 +1,31 @@
+#pragma once
+#include "colors.h"
+#include <GL/gl.h>
+#include <GLFW/glfw3.h>
+
+// Puts a colourized map on screen, scaled to the window with the nearest
+// cell for each pixel. RENDER_POINTS is the original immediate-mode path with
+// one point per window pixel. RENDER_TEXTURE uploads the RGBA8 image into a
+// texture once per frame and draws a single quad. RENDER_PBO does the same
+// through two pixel buffer objects used in turn, so the driver can still be
+// copying the last frame out of one while the next is written into the
+// other. Each falls back to the one before it where the GL lacks support.
+typedef enum { RENDER_POINTS, RENDER_TEXTURE, RENDER_PBO } RenderMode;
+
+typedef struct {
+  RenderMode mode;
+  int width, height;           // window
+  int imageWidth, imageHeight; // texture
+  GLuint texture;
+  GLuint pbos[2];
+  int nextPbo;
+} Renderer;
+
+// Needs a current GL context. mode is "points", "texture" or "pbo".
+void renderer_init(Renderer *renderer, const char *mode, int width,
+                   int height, int imageWidth, int imageHeight);
+void free_renderer(Renderer *renderer);
+// The image is only uploaded again when changed is set.
+void renderFrame(Renderer *renderer, const Colorizer *colorizer,
+                 bool changed);
+const char *rendererName(const Renderer *renderer);
@@ -0,0 +1,55 @@
+#include "snapshot.h"
+
+#define SNAPSHOT_FRESH 4
+
+bool snapshots_init(SnapshotBuffer *buffer, int width, int height) {
+  for (int i = 0; i < 3; ++i) {
+    buffer->slots[i].map.data = NULL;
+    buffer->slots[i].sealevel = 0.5f;
+    buffer->slots[i].iteration = 0;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (!heightmap_init(&buffer->slots[i].map, width, height)) {
+      free_snapshots(buffer);
+      return false;
+    }
+  }
+  buffer->front = 0;
+  buffer->back = 2;
+  atomic_init(&buffer->middle, 1);
+  return true;
+}
+
+void free_snapshots(SnapshotBuffer *buffer) {
+  for (int i = 0; i < 3; ++i) {
+    free_heightmap(&buffer->slots[i].map);
+  }
+}
+
+// Nothing is copied: view's storage is swapped with the back slot's, so
+// view comes back holding an older snapshot's cells, which the generator
+// overwrites on its next step anyway. The exchange publishes the slot's
+// contents to the reader.
+void snapshotPublish(SnapshotBuffer *buffer, Heightmap *view, float sealevel,
+                     int iteration) {
+  Snapshot *back = &buffer->slots[buffer->back];
+  float *data = back->map.data;
+  back->map.data = view->data;
+  view->data = data;
+  back->sealevel = sealevel;
+  back->iteration = iteration;
+  buffer->back = atomic_exchange(&buffer->middle,
+                                 buffer->back | SNAPSHOT_FRESH) &
+                 ~SNAPSHOT_FRESH;
+}
+
+// The front slot stays the reader's until its next call, so it can be drawn
+// from at leisure while the writer carries on.
+const Snapshot *snapshotLatest(SnapshotBuffer *buffer, bool *fresh) {
+  *fresh = (atomic_load(&buffer->middle) & SNAPSHOT_FRESH) != 0;
+  if (*fresh) {
+    buffer->front =
+        atomic_exchange(&buffer->middle, buffer->front) & ~SNAPSHOT_FRESH;
+  }
+  return &buffer->slots[buffer->front];
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "heightmap.h"
+#include <stdatomic.h>
+
+// One finished generator iteration, as the viewer draws it.
+typedef struct {
+  Heightmap map; // normalized to [0, 1]
+  float sealevel;
+  int iteration;
+} Snapshot;
+
+// A lock-free triple buffer handing snapshots from one writer thread to one
+// reader thread. The writer fills the back slot and swaps it with the middle
+// one; the reader swaps the middle slot for its front one whenever a newer
+// snapshot is waiting. Neither side ever waits, and the reader always gets
+// the latest complete snapshot while older ones are simply dropped.
+typedef struct {
+  Snapshot slots[3];
+  int back;          // writer only
+  int front;         // reader only
+  atomic_int middle; // slot index, plus SNAPSHOT_FRESH when not yet read
+} SnapshotBuffer;
+
+bool snapshots_init(SnapshotBuffer *buffer, int width, int height);
+void free_snapshots(SnapshotBuffer *buffer);
+void snapshotPublish(SnapshotBuffer *buffer, Heightmap *view, float sealevel,
+                     int iteration);
+const Snapshot *snapshotLatest(SnapshotBuffer *buffer, bool *fresh);
@@ -0,0 +1,156 @@
+#include "thermal.h"
+#include "common.h"
+#include "parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define THERMAL_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Thermal erosion moves material between every pair of neighbouring cells
+// whose height difference is steeper than the talus slope, by THERMAL_RATE
+// times the excess. Each cell only sums what flows across its own eight
+// edges, so a pass reads one buffer and writes the other, and the pairwise
+// flows cancel out so material is conserved.
+#define THERMAL_TILE_ROWS 32
+#define DIAGONAL_TALUS (THERMAL_TALUS * 1.41421356f)
+
+typedef struct {
+  const float *src;
+  float *dst;
+  int width, height;
+} ThermalJob;
+
+static float talusFlow(float center, float neighbour, float talus) {
+  float diff = neighbour - center;
+  float excess = fabsf(diff) - talus;
+  return excess > 0 ? copysignf(excess, diff) : 0;
+}
+
+// One cell, with neighbours outside the map treated as flat.
+static float thermalCell(const float *src, int width, int height, int x,
+                         int y) {
+  int i = y * width + x;
+  float center = src[i];
+  bool left = x > 0, right = x < width - 1;
+  bool up = y > 0, down = y < height - 1;
+  float orthogonal = 0, diagonal = 0;
+  if (left)
+    orthogonal += talusFlow(center, src[i - 1], THERMAL_TALUS);
+  if (right)
+    orthogonal += talusFlow(center, src[i + 1], THERMAL_TALUS);
+  if (up)
+    orthogonal += talusFlow(center, src[i - width], THERMAL_TALUS);
+  if (down)
+    orthogonal += talusFlow(center, src[i + width], THERMAL_TALUS);
+  if (up && left)
+    diagonal += talusFlow(center, src[i - width - 1], DIAGONAL_TALUS);
+  if (up && right)
+    diagonal += talusFlow(center, src[i - width + 1], DIAGONAL_TALUS);
+  if (down && left)
+    diagonal += talusFlow(center, src[i + width - 1], DIAGONAL_TALUS);
+  if (down && right)
+    diagonal += talusFlow(center, src[i + width + 1], DIAGONAL_TALUS);
+  return center + THERMAL_RATE * (orthogonal + diagonal);
+}
+
+static void thermalRowScalar(const ThermalJob *job, int y, int x0, int x1) {
+  for (int x = x0; x < x1; ++x) {
+    job->dst[y * job->width + x] =
+        thermalCell(job->src, job->width, job->height, x, y);
+  }
+}
+
+#ifdef THERMAL_SIMD
+__attribute__((target("avx2"))) static __m256
+talusFlow8(__m256 center, const float *neighbour, __m256 talus) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(neighbour), center);
+  __m256 excess = _mm256_max_ps(
+      _mm256_sub_ps(_mm256_andnot_ps(sign, diff), talus), _mm256_setzero_ps());
+  return _mm256_or_ps(excess, _mm256_and_ps(diff, sign));
+}
+
+// Eight cells of row y at a time, for columns in [x0, x1) that have all eight
+// neighbours. Flows are summed in the same order as thermalCell(), so both
+// paths give the same heights. Returns the first column left over.
+__attribute__((target("avx2"))) static int
+thermalRowAVX2(const float *src, float *dst, int width, int y, int x0, int x1) {
+  const __m256 talus = _mm256_set1_ps(THERMAL_TALUS);
+  const __m256 diagonalTalus = _mm256_set1_ps(DIAGONAL_TALUS);
+  const __m256 rate = _mm256_set1_ps(THERMAL_RATE);
+  int x = x0;
+  for (; x + 8 <= x1; x += 8) {
+    const float *p = src + y * width + x;
+    __m256 center = _mm256_loadu_ps(p);
+    __m256 orthogonal = talusFlow8(center, p - 1, talus);
+    orthogonal = _mm256_add_ps(orthogonal, talusFlow8(center, p + 1, talus));
+    orthogonal = _mm256_add_ps(orthogonal,
+                               talusFlow8(center, p - width, talus));
+    orthogonal = _mm256_add_ps(orthogonal,
+                               talusFlow8(center, p + width, talus));
+    __m256 diagonal = talusFlow8(center, p - width - 1, diagonalTalus);
+    diagonal = _mm256_add_ps(
+        diagonal, talusFlow8(center, p - width + 1, diagonalTalus));
+    diagonal = _mm256_add_ps(
+        diagonal, talusFlow8(center, p + width - 1, diagonalTalus));
+    diagonal = _mm256_add_ps(
+        diagonal, talusFlow8(center, p + width + 1, diagonalTalus));
+    __m256 flow = _mm256_mul_ps(rate, _mm256_add_ps(orthogonal, diagonal));
+    _mm256_storeu_ps(dst + y * width + x, _mm256_add_ps(center, flow));
+  }
+  return x;
+}
+
+#endif
+
+static void thermalTask(void *arg, size_t begin, size_t end) {
+  ThermalJob *job = (ThermalJob *)arg;
+  const int width = job->width, height = job->height;
+  for (size_t tile = begin; tile < end; ++tile) {
+    int y0 = tile * THERMAL_TILE_ROWS;
+    int y1 = y0 + THERMAL_TILE_ROWS < height ? y0 + THERMAL_TILE_ROWS : height;
+    for (int y = y0; y < y1; ++y) {
+      if (y == 0 || y == height - 1) {
+        thermalRowScalar(job, y, 0, width);
+        continue;
+      }
+      thermalRowScalar(job, y, 0, 1);
+      int x = 1;
+#ifdef THERMAL_SIMD
+      if (haveAVX2())
+        x = thermalRowAVX2(job->src, job->dst, width, y, x, width - 1);
+#endif
+      thermalRowScalar(job, y, x, width);
+    }
+  }
+}
+
+void thermalErode(Heightmap *heightmap, int numIterations, size_t nThreads) {
+  const size_t cells = (size_t)heightmap->width * heightmap->height;
+  float *map = heightmap->data;
+  float *scratch = (float *)malloc(cells * sizeof(float));
+  if (scratch == NULL) {
+    fprintf(stderr, "Memory allocation failed for thermal erosion.\n");
+    return;
+  }
+
+  const size_t nTiles =
+      (heightmap->height + THERMAL_TILE_ROWS - 1) / THERMAL_TILE_ROWS;
+  ThermalJob job = {map, scratch, heightmap->width, heightmap->height};
+  for (int iteration = 0; iteration < numIterations; ++iteration) {
+    parallelFor(nTiles, nThreads, thermalTask, &job);
+    float *swap = (float *)job.src;
+    job.src = job.dst;
+    job.dst = swap;
+  }
+  if (job.src != map) {
+    memcpy(map, job.src, cells * sizeof(float));
+  }
+  free(scratch);
+}
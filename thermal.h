@@ -0,0 +1,6 @@
+#pragma once
+#include "common.h"
+#include "heightmap.h"
+#include <stddef.h>
+
+void thermalErode(Heightmap *map, int numIterations, size_t nThreads);
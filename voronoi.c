@@ -0,0 +1,246 @@
+#include "voronoi.h"
+#include "common.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static float distance(float x1, float y1, float x2, float y2) {
+  float deltaX = x1 - x2;
+  float deltaY = y1 - y2;
+  return sqrt(deltaX * deltaX + deltaY * deltaY);
+}
+
+bool voronoiLabelsInit(VoronoiLabels *voronoi, int width, int height) {
+  size_t pixels = (size_t)width * height;
+  voronoi->width = width;
+  voronoi->height = height;
+  voronoi->labels = (int *)calloc(pixels, sizeof(int));
+  voronoi->distances = (float *)calloc(pixels, sizeof(float));
+  if (voronoi->labels == NULL || voronoi->distances == NULL) {
+    fprintf(stderr, "Memory allocation failed for Voronoi labels.\n");
+    voronoiLabelsFree(voronoi);
+    return false;
+  }
+  return true;
+}
+
+void voronoiLabelsFree(VoronoiLabels *voronoi) {
+  free(voronoi->labels);
+  free(voronoi->distances);
+  voronoi->labels = NULL;
+  voronoi->distances = NULL;
+}
+
+// Insertion sort by x, then index. Layers hold a few dozen sites, and unlike
+// qsort this needs no shared comparator state, so threads can sort at once.
+static void sortByX(int *order, const Vector points[], size_t length) {
+  for (size_t n = 1; n < length; ++n) {
+    int q = order[n];
+    size_t k = n;
+    while (k > 0 && (points[order[k - 1]].x > points[q].x ||
+                     (points[order[k - 1]].x == points[q].x &&
+                      order[k - 1] > q))) {
+      order[k] = order[k - 1];
+      k--;
+    }
+    order[k] = q;
+  }
+}
+
+bool voronoiRowsInit(VoronoiRows *rows, const Vector points[], size_t length,
+                     int width) {
+  rows->points = points;
+  rows->length = length;
+  rows->width = width;
+  rows->order = (int *)calloc(length + 1, sizeof(int));
+  rows->hull = (int *)calloc(length + 1, sizeof(int));
+  rows->bounds = (double *)calloc(length + 2, sizeof(double));
+  if (rows->order == NULL || rows->hull == NULL || rows->bounds == NULL) {
+    fprintf(stderr, "Memory allocation failed for Voronoi envelope.\n");
+    voronoiRowsFree(rows);
+    return false;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    rows->order[i] = i;
+  }
+  sortByX(rows->order, points, length);
+  return true;
+}
+
+void voronoiRowsFree(VoronoiRows *rows) {
+  free(rows->order);
+  free(rows->hull);
+  free(rows->bounds);
+  rows->order = NULL;
+  rows->hull = NULL;
+  rows->bounds = NULL;
+}
+
+// Float distances are within this share of the exact squared distances
+// (a few float epsilons), so sites further apart than that in squared
+// distance compare the same either way.
+#define ROUNDING_SLACK 1e-5
+
+// The brute-force search takes the site with the smallest float distance(),
+// and the lowest index among equal ones. Returns whichever of sites a and b
+// it would pick at (x, y).
+static int nearerSite(const Vector points[], int x, int y, int a, int b) {
+  double ax = x - (double)points[a].x, ay = y - (double)points[a].y;
+  double bx = x - (double)points[b].x, by = y - (double)points[b].y;
+  double da = ax * ax + ay * ay, db = bx * bx + by * by;
+  double slack = ROUNDING_SLACK * (da < db ? da : db) + 1e-9;
+  if (da + slack < db)
+    return a;
+  if (db + slack < da)
+    return b;
+  float fa = distance(x, y, points[a].x, points[a].y);
+  float fb = distance(x, y, points[b].x, points[b].y);
+  if (fa != fb)
+    return fa < fb ? a : b;
+  return a < b ? a : b;
+}
+
+// How far from crossing j, between hull[j - 1] and hull[j], the two squared
+// distances stay within slack of each other. Their difference is linear in x
+// with slope 2 * (the sites' x gap).
+static double crossingReach(const VoronoiRows *rows, int j, double slack) {
+  const Vector *points = rows->points;
+  double gap = fabs(points[rows->hull[j]].x - points[rows->hull[j - 1]].x);
+  return gap > 0 ? slack / (2 * gap) : INFINITY;
+}
+
+// Within row y, site s contributes the parabola (x - s.x)^2 + (y - s.y)^2,
+// and the nearest site for each pixel is the lower envelope of those
+// parabolas (Felzenszwalb & Huttenlocher). With the sites already sorted by x
+// a row costs O(sites + width), so a whole layer is O(pixels) for any layer
+// smaller than the map width.
+void voronoiLabelRow(VoronoiRows *rows, size_t y, int *labels) {
+  const Vector *points = rows->points;
+  const int *order = rows->order;
+  int *hull = rows->hull;
+  double *bounds = rows->bounds;
+  if (rows->length == 0)
+    return;
+
+  int k = 0;
+  hull[0] = order[0];
+  bounds[0] = -INFINITY;
+  bounds[1] = INFINITY;
+  for (size_t n = 1; n < rows->length; ++n) {
+    int q = order[n];
+    double qx = points[q].x;
+    double fq = ((double)y - points[q].y) * ((double)y - points[q].y);
+    double crossing;
+    for (;;) {
+      int s = hull[k];
+      double sx = points[s].x;
+      double fs = ((double)y - points[s].y) * ((double)y - points[s].y);
+      if (qx == sx) {
+        // Same vertex: only the lower parabola (or lower index) survives.
+        crossing = (fq < fs || (fq == fs && q < s)) ? -INFINITY : INFINITY;
+      } else {
+        crossing = ((fq + qx * qx) - (fs + sx * sx)) / (2 * qx - 2 * sx);
+      }
+      // A site left with an empty interval stays: it ties where it starts.
+      if (crossing >= bounds[k] || k == 0)
+        break;
+      k--;
+    }
+    if (crossing == INFINITY)
+      continue;
+    if (crossing == -INFINITY) {
+      // q is below the whole remaining envelope.
+      hull[k] = q;
+    } else {
+      k++;
+      hull[k] = q;
+      bounds[k] = crossing;
+    }
+    bounds[k + 1] = INFINITY;
+  }
+
+  // The envelope is exact in double precision, but the brute-force search
+  // compares rounded float distances, so close to a crossing it can pick the
+  // site on the other side. Pixels within reach of a crossing are settled
+  // its way against every site whose squared distance is that close.
+  const int last = k;
+  double farthest = 0;
+  for (int j = 0; j <= last; ++j) {
+    double dx = fabs(points[hull[j]].x) + rows->width;
+    double dy = (double)y - points[hull[j]].y;
+    if (dx * dx + dy * dy > farthest)
+      farthest = dx * dx + dy * dy;
+  }
+  const double slack = ROUNDING_SLACK * farthest + 1e-9;
+  double leftReach = -INFINITY, rightReach = INFINITY;
+  k = -1;
+  for (int x = 0; x < rows->width; ++x) {
+    if (k < 0 || bounds[k + 1] < x) {
+      do {
+        k++;
+      } while (bounds[k + 1] < x);
+      leftReach = k > 0 ? bounds[k] + crossingReach(rows, k, slack) : -INFINITY;
+      rightReach = k < last
+                       ? bounds[k + 1] - crossingReach(rows, k + 1, slack)
+                       : INFINITY;
+    }
+    int label = hull[k];
+    if (x <= leftReach) {
+      for (int j = k; j > 0; --j) {
+        if (j < k && x > bounds[j] + crossingReach(rows, j, slack))
+          break;
+        label = nearerSite(points, x, y, label, hull[j - 1]);
+      }
+    }
+    if (x >= rightReach) {
+      for (int j = k + 1; j <= last; ++j) {
+        if (j > k + 1 && x < bounds[j] - crossingReach(rows, j, slack))
+          break;
+        label = nearerSite(points, x, y, label, hull[j]);
+      }
+    }
+    labels[x] = label;
+  }
+}
+
+void voronoiLabel(VoronoiLabels *voronoi, const Vector points[],
+                  size_t length) {
+  const size_t width = voronoi->width;
+  VoronoiRows rows;
+  if (length == 0 || !voronoiRowsInit(&rows, points, length, width))
+    return;
+  for (size_t y = 0; y < (size_t)voronoi->height; ++y) {
+    int *labels = voronoi->labels + y * width;
+    voronoiLabelRow(&rows, y, labels);
+    for (size_t x = 0; x < width; ++x) {
+      voronoi->distances[y * width + x] =
+          distance(x, y, points[labels[x]].x, points[labels[x]].y);
+    }
+  }
+  voronoiRowsFree(&rows);
+}
+
+// Counts pixels labelled with a different site than the brute-force
+// nearest-site search picks, ties to the lower index included.
+size_t voronoiCrossCheck(const VoronoiLabels *voronoi, const Vector points[],
+                         size_t length) {
+  const size_t width = voronoi->width;
+  size_t mismatches = 0;
+  for (size_t y = 0; y < (size_t)voronoi->height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      float closestD = FLT_MAX;
+      int closest = -1;
+      for (size_t i = 0; i < length; ++i) {
+        float d = distance(x, y, points[i].x, points[i].y);
+        if (d < closestD) {
+          closestD = d;
+          closest = i;
+        }
+      }
+      if (voronoi->labels[y * width + x] != closest)
+        mismatches++;
+    }
+  }
+  return mismatches;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "common.h"
+
+// Nearest-site label and distance for every pixel of a width x height map,
+// stored in the same row-major order as a Heightmap: index y * width + x.
+typedef struct {
+  int width, height;
+  int *labels;
+  float *distances;
+} VoronoiLabels;
+
+// Sites of one layer sorted for labelling a row at a time, plus scratch space
+// for the envelope.
+typedef struct {
+  const Vector *points;
+  size_t length;
+  int width; // pixels in a row
+  int *order;
+  int *hull;
+  double *bounds;
+} VoronoiRows;
+
+bool voronoiRowsInit(VoronoiRows *rows, const Vector points[], size_t length,
+                     int width);
+void voronoiRowsFree(VoronoiRows *rows);
+// Labels each pixel of row y with the site the brute-force search would pick:
+// the smallest float distance(), then the lowest index. The envelope is
+// built in double precision and pixels near its crossings are settled with
+// the float distances. One case is left: a site whose parabola misses the
+// row's envelope by less than float rounding can tie or win in float without
+// ever being compared, and then the label differs from brute force.
+void voronoiLabelRow(VoronoiRows *rows, size_t y, int *labels);
+
+bool voronoiLabelsInit(VoronoiLabels *voronoi, int width, int height);
+void voronoiLabelsFree(VoronoiLabels *voronoi);
+void voronoiLabel(VoronoiLabels *voronoi, const Vector points[],
+                  size_t length);
+size_t voronoiCrossCheck(const VoronoiLabels *voronoi, const Vector points[],
+                         size_t length);